@@ -26,6 +26,23 @@ void adler32_push(struct adler32* adler, const uint8_t* data, size_t n)
 	}
 }
 
+void adler32_append(struct adler32* adler, uint32_t checksum, size_t n)
+{
+	// same as zlib's adler32_combine()
+	const uint32_t mod = 65521;
+	const uint32_t rem = n % mod;
+	const uint32_t a2 = checksum & 0xffff;
+	const uint32_t b2 = checksum >> 16;
+	uint32_t a = adler->a + a2 + mod - 1;
+	uint32_t b = (uint32_t)(((uint64_t)rem * adler->a) % mod) + adler->b + b2 + mod - rem;
+	if (a >= mod) a -= mod;
+	if (a >= mod) a -= mod;
+	if (b >= 2*mod) b -= 2*mod;
+	if (b >= mod) b -= mod;
+	adler->a = a;
+	adler->b = b;
+}
+
 uint32_t adler32_sum(struct adler32* adler)
 {
 	return (adler->b<<16) | adler->a;
@@ -71,6 +88,21 @@ static void test1(char ch, int n, uint32_t expected_checksum)
 	}
 }
 
+static void test_append(const char* str)
+{
+	const size_t n = strlen(str);
+	for (size_t split = 0; split <= n; split++) {
+		struct adler32 adler;
+		adler32_init(&adler);
+		adler32_push(&adler, (const uint8_t*)str, split);
+		adler32_append(&adler, adler32((const uint8_t*)str + split, n - split), n - split);
+		if (adler32_sum(&adler) != adler32((const uint8_t*)str, n)) {
+			fprintf(stderr, "FAIL: adler32_append() of \"%s\" split at %zd\n", str, split);
+			FAIL = 1;
+		}
+	}
+}
+
 int main(int argc, char** argv)
 {
 	// testing against zlib.adler32() in Python
@@ -81,6 +113,21 @@ int main(int argc, char** argv)
 	test1('~', 1000000, 227871790);
 	test1(255, 1000000, 943972798);
 	test1(254, 10000000, 1249063539);
+	test_append("af.aewf.32r.h.y.hjfgkdsjfjakhk43htkh5h6hkj45h6kj54h6kj45h6k456ds.f.hgfh;'h;'t;h;';hgfhgf;h;ffhg");
+	{
+		char* bs = malloc(200000);
+		for (int i = 0; i < 200000; i++) bs[i] = 255 - (i & 7);
+		bs[199999] = 0;
+		struct adler32 adler;
+		adler32_init(&adler);
+		adler32_push(&adler, (uint8_t*)bs, 123456);
+		adler32_append(&adler, adler32((uint8_t*)bs + 123456, 199999 - 123456), 199999 - 123456);
+		if (adler32_sum(&adler) != adler32((uint8_t*)bs, 199999)) {
+			fprintf(stderr, "FAIL: adler32_append() of long run\n");
+			FAIL = 1;
+		}
+		free(bs);
+	}
 	printf("OK\n");
 	return FAIL ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -10,6 +10,9 @@ struct adler32 {
 uint32_t adler32(const uint8_t* data, size_t n);
 void adler32_init(struct adler32* adler);
 void adler32_push(struct adler32*, const uint8_t* data, size_t n);
+// folds in the adler32 `checksum` of `n` bytes following the pushed data, as
+// if they had been pushed
+void adler32_append(struct adler32*, uint32_t checksum, size_t n);
 uint32_t adler32_sum(struct adler32*);
 
 #define ADLER32_H
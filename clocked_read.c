@@ -1,97 +1,381 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
 #include "hardware/dma.h"
+#include "hardware/sync.h"
 
 #include "clocked_read.h"
 #include "clocked_read.pio.h"
 #include "base.h"
 #include "pin_config.h"
 
-static uint8_t buffer[CLOCKED_READ_BUFFER_COUNT][MAX_DATA_BUFFER_SIZE];
-static unsigned buffer_size[CLOCKED_READ_BUFFER_COUNT];
-static enum buffer_status buffer_status[CLOCKED_READ_BUFFER_COUNT];
-static char buffer_filename[CLOCKED_READ_BUFFER_COUNT][CLOCKED_READ_BUFFER_FILENAME_MAX_LENGTH];
+// Single-producer/single-consumer ring. Positions run from 0 to
+// 2*ring_size-1 so that "full" and "empty" can be told apart
+// without a division. The producer owns alloc_pos and write_pos and the
+// consumer owns read_pos; each side only reads the other's position, and the
+// __dmb()s make sure buffer contents are visible before a position is
+// published. The producer may have several buffers allocated (between
+// write_pos and alloc_pos) but must write them in allocation order.
+//
+// Each buffer starts with a struct ring_entry header. An allocation never
+// wraps around the end of the ring; instead the tail is skipped, and a header
+// with span==0 is left behind (if there's room for one) to tell the consumer
+// to skip it too.
+
+struct ring_entry {
+	volatile uint32_t status;
+	uint32_t size;
+	uint32_t span; // header+data rounded up to 4 bytes; 0=skip to start of ring
+	uint32_t n_sectors; // 0=no sector status
+	uint32_t address_ok_mask;
+	uint32_t data_ok_mask;
+	uint32_t has_sector_attempts;
+	uint8_t sector_attempts[CLOCKED_READ_MAX_SECTORS];
+	uint32_t has_capture_telemetry;
+	struct capture_telemetry capture_telemetry;
+	uint32_t has_batch_position;
+	struct batch_position batch_position;
+	char filename[CLOCKED_READ_BUFFER_FILENAME_MAX_LENGTH];
+};
+_Static_assert((sizeof(struct ring_entry) & 3) == 0, "must preserve 32-bit alignment of data");
+_Static_assert((CLOCKED_READ_MAX_SECTORS & 3) == 0, "must preserve 32-bit alignment of data");
+_Static_assert(sizeof(struct ring_entry) <= 1024, "max span must fit in half the ring; see get_max_buffer_size()");
+
+// set by the linker script
+extern uint8_t __bss_end__[];
+extern uint8_t __StackLimit[];
 
-static void check_buffer_index(unsigned buffer_index)
+static uint8_t* ring;
+static uint32_t ring_size; // multiple of 8
+static unsigned max_allocation_size;
+static volatile uint32_t write_pos;
+static volatile uint32_t read_pos;
+static uint32_t alloc_pos; // producer only; never published
+
+static unsigned high_water_mark;
+static unsigned n_allocations;
+static unsigned n_producer_stalls;
+static uint64_t producer_stall_us;
+static volatile int is_lent; // see lend_buffer_memory()
+
+static inline uint32_t pos_to_offset(uint32_t pos)
 {
-	if (buffer_index >= CLOCKED_READ_BUFFER_COUNT) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	return pos < ring_size ? pos : pos - ring_size;
 }
 
-static int find_buffer_index(enum buffer_status with_buffer_status)
+static inline uint32_t pos_advance(uint32_t pos, uint32_t n)
 {
-	for (unsigned i = 0; i < CLOCKED_READ_BUFFER_COUNT; i++) {
-		if (buffer_status[i] == with_buffer_status) {
-			return i;
-		}
-	}
-	return -1;
+	pos += n;
+	return pos < 2*ring_size ? pos : pos - 2*ring_size;
 }
 
-static int get_next_free_buffer_index(void)
+static inline uint32_t pos_distance(uint32_t from, uint32_t to)
 {
-	return find_buffer_index(FREE);
+	return to >= from ? to - from : (to + 2*ring_size) - from;
 }
 
-int get_written_buffer_index(void)
+static inline struct ring_entry* get_entry(unsigned buffer_index)
+{
+	if (buffer_index >= ring_size || (buffer_index & 3) != 0) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	return (struct ring_entry*)&ring[buffer_index];
+}
+
+static inline unsigned get_span(unsigned size)
+{
+	return (sizeof(struct ring_entry) + size + 3) & ~3;
+}
+
+static inline unsigned clamp_size(unsigned size)
+{
+	return size > max_allocation_size ? max_allocation_size : size;
+}
+
+// bytes needed at `pos` to allocate `span` bytes, including any skipped tail
+static unsigned get_required_bytes(uint32_t pos, unsigned span)
+{
+	const unsigned tail = ring_size - pos_to_offset(pos);
+	return tail >= span ? span : tail + span;
+}
+
+void init_buffers(void)
+{
+	if (ring != NULL) PANIC(PANIC_UNEXPECTED_STATE);
+	const unsigned n_free = __StackLimit - __bss_end__;
+	if (n_free < (CLOCKED_READ_MIN_RING_SIZE + CLOCKED_READ_HEAP_RESERVE)) PANIC(PANIC_ALLOCATION_ERROR);
+	ring_size = (n_free - CLOCKED_READ_HEAP_RESERVE) & ~7;
+	// malloc() (newlib's sbrk()) hands out memory from the end of .bss up;
+	// allocating the ring first puts it right there
+	ring = malloc(ring_size);
+	if (ring == NULL) PANIC(PANIC_ALLOCATION_ERROR);
+	max_allocation_size = ring_size/2 - 1024;
+	reset_buffers();
+}
+
+unsigned get_max_buffer_size(void)
 {
-	return find_buffer_index(WRITTEN);
+	return max_allocation_size;
 }
 
-unsigned can_allocate_buffer(void)
+unsigned can_allocate_buffer(unsigned size)
 {
-	return get_next_free_buffer_index() >= 0;
+	const uint32_t a = alloc_pos;
+	const uint32_t r = read_pos;
+	__dmb();
+	const unsigned n_free = ring_size - pos_distance(r, a);
+	return !is_lent && get_required_bytes(a, get_span(clamp_size(size))) <= n_free;
+}
+
+void add_producer_stall(uint64_t us)
+{
+	n_producer_stalls++;
+	producer_stall_us += us;
 }
 
 unsigned allocate_buffer(unsigned size)
 {
-	const int i = get_next_free_buffer_index();
-	if (i < 0) PANIC(PANIC_ALLOCATION_ERROR);
-	check_buffer_index(i);
-	buffer_status[i] = BUSY;
-	if (size > MAX_DATA_BUFFER_SIZE) size = MAX_DATA_BUFFER_SIZE;
-	buffer_size[i] = size;
-	return i;
+	if (!can_allocate_buffer(size)) PANIC(PANIC_ALLOCATION_ERROR);
+
+	size = clamp_size(size);
+	const unsigned span = get_span(size);
+	uint32_t pos = alloc_pos;
+	const unsigned tail = ring_size - pos_to_offset(pos);
+	if (tail < span) {
+		if (tail >= sizeof(struct ring_entry)) {
+			struct ring_entry* skip = get_entry(pos_to_offset(pos));
+			skip->span = 0;
+			skip->size = 0;
+			skip->status = FREE;
+		}
+		pos = pos_advance(pos, tail);
+	}
+
+	const unsigned used = pos_distance(read_pos, pos_advance(pos, span));
+	if (used > high_water_mark) high_water_mark = used;
+	n_allocations++;
+
+	const unsigned buffer_index = pos_to_offset(pos);
+	struct ring_entry* e = get_entry(buffer_index);
+	e->status = BUSY;
+	e->size = size;
+	e->span = span;
+	e->filename[0] = 0;
+	e->n_sectors = 0;
+	e->has_sector_attempts = 0;
+	e->has_capture_telemetry = 0;
+	e->has_batch_position = 0;
+	alloc_pos = pos_advance(pos, span);
+	return buffer_index;
 }
 
 uint8_t* get_buffer_data(unsigned buffer_index)
 {
-	check_buffer_index(buffer_index);
-	return buffer[buffer_index];
+	return (uint8_t*)(get_entry(buffer_index) + 1);
 }
 
 char* get_buffer_filename(unsigned buffer_index)
 {
-	check_buffer_index(buffer_index);
-	return buffer_filename[buffer_index];
+	return get_entry(buffer_index)->filename;
 }
 
 enum buffer_status get_buffer_status(unsigned buffer_index)
 {
-	check_buffer_index(buffer_index);
-	return buffer_status[buffer_index];
+	return get_entry(buffer_index)->status;
 }
 
-void release_buffer(unsigned buffer_index)
+// skips tail/skip marker at `pos` if there is one
+static uint32_t skip_to_entry(uint32_t pos)
+{
+	const uint32_t offset = pos_to_offset(pos);
+	const unsigned tail = ring_size - offset;
+	if (tail < sizeof(struct ring_entry) || get_entry(offset)->span == 0) {
+		return pos_advance(pos, tail);
+	}
+	return pos;
+}
+
+static void publish_buffer(unsigned buffer_index, enum buffer_status status)
 {
-	check_buffer_index(buffer_index);
-	if (buffer_status[buffer_index] != WRITTEN) PANIC(PANIC_UNEXPECTED_STATE);
-	buffer_status[buffer_index] = FREE;
+	if (write_pos == alloc_pos) PANIC(PANIC_UNEXPECTED_STATE);
+	const uint32_t pos = skip_to_entry(write_pos);
+	if (pos_to_offset(pos) != buffer_index) PANIC(PANIC_UNEXPECTED_STATE); // must be oldest allocation
+	struct ring_entry* e = get_entry(buffer_index);
+	if (e->status != BUSY) PANIC(PANIC_UNEXPECTED_STATE);
+	e->status = status;
+	__dmb(); // publish entry (and data) before moving write_pos
+	write_pos = pos_advance(pos, e->span);
 }
 
 void wrote_buffer(unsigned buffer_index)
 {
-	check_buffer_index(buffer_index);
-	if (buffer_status[buffer_index] != BUSY) PANIC(PANIC_UNEXPECTED_STATE);
-	buffer_status[buffer_index] = WRITTEN;
+	publish_buffer(buffer_index, WRITTEN);
+}
+
+void discard_buffer(unsigned buffer_index)
+{
+	publish_buffer(buffer_index, DISCARDED);
+}
+
+// producer was terminated (e.g. job reset mid-capture); unwritten
+// allocations are discarded. NOTE: producer must not be running
+void abandon_unwritten_buffers(void)
+{
+	alloc_pos = write_pos;
+}
+
+// hands space back to the producer, and wakes it if it's waiting for room
+// (see add_producer_stall())
+static inline void set_read_pos(uint32_t pos)
+{
+	read_pos = pos;
+	__sev();
+}
+
+int get_written_buffer_index(void)
+{
+	for (;;) {
+		const uint32_t r = read_pos;
+		const uint32_t w = write_pos;
+		__dmb();
+		if (r == w) return -1;
+		const uint32_t r1 = skip_to_entry(r);
+		if (r1 != r) {
+			set_read_pos(r1);
+			continue;
+		}
+		const uint32_t offset = pos_to_offset(r);
+		struct ring_entry* e = get_entry(offset);
+		if (e->status == DISCARDED) {
+			e->status = FREE;
+			__dmb();
+			set_read_pos(pos_advance(r, e->span));
+			continue;
+		}
+		if (e->status != WRITTEN) PANIC(PANIC_UNEXPECTED_STATE);
+		return offset;
+	}
+}
+
+void release_buffer(unsigned buffer_index)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	const uint32_t r = read_pos;
+	if (pos_to_offset(r) != buffer_index) PANIC(PANIC_UNEXPECTED_STATE);
+	if (e->status != WRITTEN) PANIC(PANIC_UNEXPECTED_STATE);
+	e->status = FREE;
+	__dmb(); // done with data before handing it back to the producer
+	set_read_pos(pos_advance(r, e->span));
+}
+
+void set_buffer_sector_status(unsigned buffer_index, unsigned n_sectors, uint32_t address_ok_mask, uint32_t data_ok_mask)
+{
+	if (n_sectors > CLOCKED_READ_MAX_SECTORS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	struct ring_entry* e = get_entry(buffer_index);
+	e->n_sectors = n_sectors;
+	e->address_ok_mask = address_ok_mask;
+	e->data_ok_mask = data_ok_mask;
+}
+
+int get_buffer_sector_status(unsigned buffer_index, uint32_t* address_ok_mask, uint32_t* data_ok_mask)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	if (e->n_sectors == 0) return 0;
+	*address_ok_mask = e->address_ok_mask;
+	*data_ok_mask = e->data_ok_mask;
+	return e->n_sectors;
+}
+
+void set_buffer_sector_attempts(unsigned buffer_index, const uint8_t* attempts)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	e->has_sector_attempts = 1;
+	memcpy(e->sector_attempts, attempts, sizeof e->sector_attempts);
+}
+
+uint8_t* get_buffer_sector_attempts(unsigned buffer_index)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	return e->has_sector_attempts ? e->sector_attempts : NULL;
+}
+
+const struct capture_telemetry* get_buffer_capture_telemetry(unsigned buffer_index)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	return e->has_capture_telemetry ? &e->capture_telemetry : NULL;
+}
+
+void set_buffer_capture_telemetry(unsigned buffer_index, const struct capture_telemetry* telemetry)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	e->has_capture_telemetry = 1;
+	e->capture_telemetry = *telemetry;
+}
+
+const struct batch_position* get_buffer_batch_position(unsigned buffer_index)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	return e->has_batch_position ? &e->batch_position : NULL;
+}
+
+void set_buffer_batch_position(unsigned buffer_index, const struct batch_position* position)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	e->has_batch_position = 1;
+	e->batch_position = *position;
 }
 
 unsigned get_buffer_size(unsigned buffer_index)
 {
-	check_buffer_index(buffer_index);
-	return buffer_size[buffer_index];
+	return get_entry(buffer_index)->size;
 }
 
+void set_buffer_size(unsigned buffer_index, unsigned size)
+{
+	struct ring_entry* e = get_entry(buffer_index);
+	if (size > e->size) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	e->size = size;
+}
+
+// NOTE: must not be called while a producer or a consumer is active
 void reset_buffers(void)
 {
-	for (int i = 0; i < CLOCKED_READ_BUFFER_COUNT; i++) {
-		buffer_status[i] = FREE;
-	}
+	write_pos = 0;
+	read_pos = 0;
+	alloc_pos = 0;
+	high_water_mark = 0;
+	n_allocations = 0;
+	n_producer_stalls = 0;
+	producer_stall_us = 0;
+}
+
+uint8_t* lend_buffer_memory(unsigned size)
+{
+	if (is_lent || (size & (size-1)) != 0) PANIC(PANIC_UNEXPECTED_STATE);
+	const uint32_t r = read_pos;
+	__dmb();
+	if (r != write_pos || write_pos != alloc_pos) PANIC(PANIC_UNEXPECTED_STATE);
+	const uintptr_t p = ((uintptr_t)ring + (size-1)) & ~(uintptr_t)(size-1);
+	if ((p + size) > ((uintptr_t)ring + ring_size)) PANIC(PANIC_ALLOCATION_ERROR);
+	is_lent = 1;
+	return (uint8_t*)p;
+}
+
+// the ring is still empty; the lent memory only ever held unallocated space
+void return_buffer_memory(void)
+{
+	if (!is_lent) PANIC(PANIC_UNEXPECTED_STATE);
+	__dmb();
+	is_lent = 0;
+}
+
+void get_buffer_stats(struct buffer_stats* stats)
+{
+	const uint32_t w = write_pos;
+	const uint32_t r = read_pos;
+	stats->ring_size = ring_size;
+	stats->bytes_used = pos_distance(r, w);
+	stats->high_water_mark = high_water_mark;
+	stats->n_allocations = n_allocations;
+	stats->n_producer_stalls = n_producer_stalls;
+	stats->producer_stall_us = producer_stall_us;
 }
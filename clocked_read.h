@@ -6,25 +6,98 @@
 #include "drive.h"
 #include "controller_protocol.h"
 
-#define CLOCKED_READ_BUFFER_COUNT   4
+// Captures are allocated from a single ring buffer shared between a producer
+// (core1 jobs, or xfer_test on core0 when no job is running) and a consumer
+// (core0 data transfers). Buffer "indices" are offsets into the ring, and
+// buffers are consumed in the order they were allocated. The producer may
+// allocate several buffers ahead, but must write them in allocation order.
+// The ring takes all the RAM the linker leaves over (from __bss_end__ up to
+// the stack limit) except CLOCKED_READ_HEAP_RESERVE, which stays for
+// malloc(); see init_buffers().
+#define CLOCKED_READ_HEAP_RESERVE (8<<10)
+// smallest ring that holds two track buffers and the re-read buffer of a
+// pipelined batch read (see xop.c), or a raw read ring (see raw_stream.h)
+#define CLOCKED_READ_MIN_RING_SIZE (128<<10)
 #define CLOCKED_READ_BUFFER_FILENAME_MAX_LENGTH (128)
+#define CLOCKED_READ_MAX_SECTORS (32)
 
 enum buffer_status {
 	FREE,
 	BUSY, // "allocated" or "writing"
 	WRITTEN,
+	DISCARDED, // done with, but never transferred (see discard_buffer())
 };
 
-unsigned can_allocate_buffer(void);
+struct buffer_stats {
+	unsigned ring_size;
+	unsigned bytes_used;
+	unsigned high_water_mark;  // max bytes used (including wasted tails)
+	unsigned n_allocations;
+	unsigned n_producer_stalls; // times a producer waited for room
+	uint64_t producer_stall_us; // total time spent waiting
+};
+
+// allocates the ring; must be called before anything else uses malloc()
+void init_buffers(void);
+// header+data of an allocation must fit in half the ring, or an allocation
+// that has to skip a tail just short of its span would never fit, not even in
+// an empty ring; larger allocations are truncated to this
+unsigned get_max_buffer_size(void);
+unsigned can_allocate_buffer(unsigned size);
+// a producer that waits for room (WFE; the consumer sends an event whenever
+// it frees space) reports how long it waited
+void add_producer_stall(uint64_t us);
 unsigned allocate_buffer(unsigned size);
 uint8_t* get_buffer_data(unsigned buffer_index);
 char* get_buffer_filename(unsigned buffer_index);
 enum buffer_status get_buffer_status(unsigned buffer_index);
 void release_buffer(unsigned buffer_index);
 void wrote_buffer(unsigned buffer_index);
+// like wrote_buffer(), but the consumer skips the buffer; for producer scratch
+// space, which is written in allocation order like any other buffer
+void discard_buffer(unsigned buffer_index);
 int get_written_buffer_index(void);
 unsigned get_buffer_size(unsigned buffer_index);
+// shrinks a buffer that was allocated larger than needed (its ring span is
+// unchanged); must be called before wrote_buffer()
+void set_buffer_size(unsigned buffer_index, unsigned size);
 void reset_buffers(void);
+// lends the ring's memory to raw reads (see raw_stream.h), which never run
+// together with buffer producers; the ring must be empty. Returns `size`
+// bytes aligned to `size` (a power of two). Buffers can't be allocated until
+// the memory is returned.
+uint8_t* lend_buffer_memory(unsigned size);
+void return_buffer_memory(void);
+void abandon_unwritten_buffers(void);
+void get_buffer_stats(struct buffer_stats*);
+void set_buffer_sector_status(unsigned buffer_index, unsigned n_sectors, uint32_t address_ok_mask, uint32_t data_ok_mask);
+// returns number of sectors, or 0 if no sector status was set
+int get_buffer_sector_status(unsigned buffer_index, uint32_t* address_ok_mask, uint32_t* data_ok_mask);
+// number of reads it took to get each sector right (0=never); NULL if unset
+uint8_t* get_buffer_sector_attempts(unsigned buffer_index);
+void set_buffer_sector_attempts(unsigned buffer_index, const uint8_t* attempts);
+// capture path telemetry aggregated over all reads that went into a buffer
+// (see struct cr8044read_telemetry); NULL if unset
+struct capture_telemetry {
+	uint32_t n_captures;
+	uint32_t fdebug;            // CAPTURE_FDEBUG_* seen during any capture
+	uint32_t n_words_missing;   // capture DMA words never received (stalled captures)
+	uint32_t n_pull_words_left; // pull words never consumed
+	uint32_t total_us;
+	uint32_t max_us;
+};
+const struct capture_telemetry* get_buffer_capture_telemetry(unsigned buffer_index);
+void set_buffer_capture_telemetry(unsigned buffer_index, const struct capture_telemetry* telemetry);
+
+// where a buffer's track is in a batch read's order (op_read_batch; see
+// CPPP_BATCH_CHECKPOINT); NULL if unset
+struct batch_position {
+	uint16_t cylinder;
+	uint8_t head;
+	uint8_t adjustment; // index of the servo offset/data strobe delay pair (0 for adaptive)
+};
+const struct batch_position* get_buffer_batch_position(unsigned buffer_index);
+void set_buffer_batch_position(unsigned buffer_index, const struct batch_position* position);
 
 #define CLOCKED_READ_H
 #endif
@@ -81,6 +81,11 @@ int command_parser_put_char(struct command_parser* parser, int ch)
 				case 'i':
 					arg->i = atoi(parser->token_buffer);
 					break;
+				case 's':
+					// the next token would overwrite it
+					if (arg_index != parser->argfmt_length-1) PANIC(PANIC_UNREACHABLE);
+					arg->s = parser->token_buffer;
+					break;
 				default: PANIC(PANIC_UNREACHABLE);
 				}
 			}
@@ -150,9 +155,13 @@ int main(int argc, char** argv)
 	assert(command_parser.arguments[0].b);
 	try_parse("subscribe_to_status 424242\n", COMMAND_subscribe_to_status);
 	assert(command_parser.arguments[0].b);
-	try_parse("op_read_enable -42 66\n", COMMAND_op_read_enable);
-	assert(command_parser.arguments[0].i == -42);
-	assert(command_parser.arguments[1].i == 66);
+	try_parse("op_read_batch 0 822 0 5 -42 66 0 1\n", COMMAND_op_read_batch);
+	assert(command_parser.arguments[1].u == 822);
+	assert(command_parser.arguments[4].i == -42);
+	assert(command_parser.arguments[5].i == 66);
+	assert(command_parser.arguments[7].u == 1);
+	try_parse("script_append AQIDBA==\n", COMMAND_script_append);
+	assert(strcmp(command_parser.arguments[0].s, "AQIDBA==") == 0);
 	printf("OK\n");
 	return EXIT_SUCCESS;
 }
@@ -13,6 +13,7 @@ union command_argument {
 	unsigned b;
 	unsigned u;
 	int      i;
+	const char* s; // points into token_buffer; valid until the next character is put
 };
 
 struct command_parser {
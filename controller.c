@@ -1,13 +1,18 @@
 // deps
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include "pico/stdlib.h"
 #include "pico/unique_id.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
 #include "tusb.h"
 
 // local
 #include "pin_config.h"
 #include "base.h"
+#include "drive.h"
 #include "command_parser.h"
 #include "clocked_read.h"
 #include "cr8044read.h"
@@ -15,12 +20,22 @@
 #include "xop.h"
 #include "base64.h"
 #include "adler32.h"
+#include "xfer_frame.h"
 #include "loopback_test.h"
+#include "raw_stream.h"
+#include "sync_tune.h"
+#include "seek_profile.h"
+#include "spindle_timing.h"
+#include "pin_events.h"
 
 unsigned stdin_received_bytes;
 unsigned is_subscribing_to_status;
 struct command_parser command_parser;
 int is_job_polling;
+int is_script_job; // reports CPPP_SCRIPT_STEP lines
+int is_tag_calibration_job; // reports the new tag timing
+static uint8_t script_upload_buffer[sizeof(command_parser.token_buffer)];
+enum transfer_mode transfer_mode;
 
 static inline int gpio_type_to_dir(enum gpio_type t)
 {
@@ -33,63 +48,120 @@ static inline int gpio_type_to_dir(enum gpio_type t)
 	}
 }
 
-#define MAX_FREQUENCY_PINS (4)
-unsigned frequency_counters[MAX_FREQUENCY_PINS];
 absolute_time_t last_frequency_tick_timestamp;
 
 absolute_time_t last_status_push_timestamp;
-unsigned pushed_status;
+absolute_time_t last_status_events_flush_timestamp;
 int push_status_now;
-unsigned prev_gpio_all;
+
+#define STATUS_EVENTS_FLUSH_HZ (100)
+#define STATUS_EVENTS_PER_LINE (16)
+
+static unsigned gpio_to_status(unsigned gpio_all)
+{
+	unsigned status = 0;
+	unsigned mask = 1;
+	#define PIN(TYPE,NAME,GPN)                                    \
+		if (TYPE==STATUS) {                                   \
+			if (gpio_all & (1<<GPN)) { status |= mask; }  \
+			mask <<= 1;                                   \
+		}
+	EMIT_PIN_CONFIG
+	#undef PIN
+	return status;
+}
+
+static void flush_status_events(absolute_time_t now)
+{
+	uint32_t n_lost = pin_events_take_n_overflows();
+	if (n_lost > 0) push_status_now = 1; // resync
+	// the ring's timestamps are time_us_32(); signed, because an edge may
+	// have been recorded after `now`
+	const uint32_t now32 = (uint32_t)now;
+	uint32_t prev_us = 0;
+	struct pin_levels e;
+	int n = 0;
+	while (pin_events_pop_levels(&e)) {
+		if (!is_subscribing_to_status) continue;
+		if (n == 0) {
+			const absolute_time_t t = now - (int32_t)(now32 - e.timestamp_us);
+			printf("%s %lu %llu %d", CPPP_STATUS_EVENTS, n_lost, t, gpio_to_status(e.levels));
+			n_lost = 0;
+		} else {
+			printf(" %lu %d", e.timestamp_us - prev_us, gpio_to_status(e.levels));
+		}
+		prev_us = e.timestamp_us;
+		if (++n == STATUS_EVENTS_PER_LINE) {
+			printf("\n");
+			n = 0;
+		}
+	}
+	if (n > 0) {
+		printf("\n");
+	} else if (n_lost > 0 && is_subscribing_to_status) {
+		printf("%s %lu\n", CPPP_STATUS_EVENTS, n_lost);
+	}
+}
+
+static uint32_t cycles_to_ns(uint64_t cycles, uint32_t sys_hz)
+{
+	return (cycles * 1000000000ull) / sys_hz;
+}
+
+static void print_spindle_timing(const struct spindle_timing* t)
+{
+	const uint32_t sys_hz = clock_get_hz(clk_sys);
+
+	// INDEX is exact from the sum of the measured periods; SECTOR is
+	// counted edges over the window
+	const uint32_t index_mhz = t->n_periods == 0 ? 0 : (uint32_t)(((uint64_t)sys_hz * 1000ull * t->n_periods) / t->sum_cycles);
+	const uint32_t sector_mhz = t->window_us == 0 ? 0 : (uint32_t)(((uint64_t)t->n_sector_edges * 1000000000ull) / t->window_us);
+	printf("%s 0 %lu\n", CPPP_FREQ, index_mhz);
+	printf("%s 1 %lu\n", CPPP_FREQ, sector_mhz);
+
+	if (t->n_periods == 0) {
+		printf("%s 0 0 0 0 0 %lu\n", CPPP_REVOLUTION, t->n_dropped);
+		return;
+	}
+	const double mean_cycles = (double)t->sum_cycles / t->n_periods;
+	const double mean_deviation = mean_cycles - t->first_cycles;
+	double variance = (double)t->sum_sq_deviation / t->n_periods - mean_deviation*mean_deviation;
+	if (variance < 0) variance = 0;
+	printf("%s %lu %lu %lu %lu %lu %lu\n",
+		CPPP_REVOLUTION,
+		t->n_periods,
+		cycles_to_ns(t->sum_cycles / t->n_periods, sys_hz),
+		cycles_to_ns(t->min_cycles, sys_hz),
+		cycles_to_ns(t->max_cycles, sys_hz),
+		(uint32_t)(sqrt(variance) * 1e9 / sys_hz),
+		t->n_dropped);
+}
 
 static void status_housekeeping(void)
 {
 	const absolute_time_t now = get_absolute_time();
-	const unsigned gpio_all = gpio_get_all();
-	const unsigned gpio_edge_set = gpio_all ^ prev_gpio_all;
-	prev_gpio_all = gpio_all;
-
-	{ // handle frequent pins
-		int i = 0;
-		const int is_tick = (now - last_frequency_tick_timestamp) > FREQ_IN_MICROS(FREQ_FREQ_HZ);
-		#define PIN(TYPE,NAME,GPN)                       \
-			if (TYPE==FREQ) {                         \
-				if (i >= MAX_FREQUENCY_PINS) PANIC(PANIC_BOUNDS_CHECK_FAILED); \
-				if (gpio_edge_set & (1<<GPN)) {     \
-					frequency_counters[i]++;     \
-				}                                     \
-				if (is_tick) {                         \
-					if (is_subscribing_to_status) { \
-						printf("%s %d %d\n", CPPP_FREQ, i, frequency_counters[i]); \
-					}                                 \
-					frequency_counters[i] = 0;         \
-				}                                           \
-				i++;                                         \
-			}
-		EMIT_PIN_CONFIG
-		#undef PIN
-		if (is_tick) last_frequency_tick_timestamp = now;
+
+	// INDEX/SECTOR are timed and counted in hardware (see spindle_timing.h)
+	if ((now - last_frequency_tick_timestamp) > FREQ_IN_MICROS(FREQ_FREQ_HZ)) {
+		struct spindle_timing t;
+		spindle_timing_take(&t);
+		if (is_subscribing_to_status) print_spindle_timing(&t);
+		last_frequency_tick_timestamp = now;
 	}
 
-	unsigned status = 0;
-	{ // map status pins
-		unsigned mask = 1;
-		#define PIN(TYPE,NAME,GPN)                                    \
-			if (TYPE==STATUS) {                                   \
-				if (gpio_all & (1<<GPN)) { status |= mask; }  \
-				mask <<= 1;                                   \
-			}
-		EMIT_PIN_CONFIG
-		#undef PIN
+	// status changes are captured by the GPIO interrupt (see pin_events.h)
+	// and sent in batches; the polled status is only sent on request
+	if ((now - last_status_events_flush_timestamp) > FREQ_IN_MICROS(STATUS_EVENTS_FLUSH_HZ)) {
+		flush_status_events(now);
+		last_status_events_flush_timestamp = now;
 	}
 
-	if (push_status_now || (status != pushed_status && ((now - last_status_push_timestamp) > FREQ_IN_MICROS(200)))) {
+	if (push_status_now) {
 		if (is_subscribing_to_status) {
-			printf("%s %llu %d\n", CPPP_STATUS, now, status);
+			printf("%s %llu %d\n", CPPP_STATUS, now, gpio_to_status(gpio_get_all()));
 			last_status_push_timestamp = now;
 		}
 		push_status_now = 0;
-		pushed_status = status;
 	} else if ((now - last_status_push_timestamp) > FREQ_IN_MICROS(60)) {
 		// report controller time once in a while if nothing else is
 		// happening...
@@ -104,34 +176,37 @@ static void status_housekeeping(void)
 _Static_assert((DATA_TRANSFER_BYTES_PER_LINE % 3) == 0, "must be divisible by 3 (to make base-64 encoding easier)");
 #define DATA_TRANSFER_CHARACTERS_PER_LINE ((DATA_TRANSFER_BYTES_PER_LINE/3)*4)
 #define DATA_TRANSFER_LINES_PER_CHUNK (10)
+#define DATA_TRANSFER_BYTES_PER_FRAME (1<<10)
+_Static_assert(DATA_TRANSFER_BYTES_PER_FRAME <= XFER_FRAME_MAX_PAYLOAD, "frame too big");
 
 struct {
 	int is_transfering;
+	int is_binary;
+	int is_raw_stream;
 	unsigned buffer_index;
 	unsigned bytes_transferred;
 	unsigned bytes_total;
 	unsigned sequence;
 	struct adler32 adler;
+	unsigned frame_size;
+	unsigned frame_cursor;
+	uint8_t frame[XFER_FRAME_HEADER_SIZE + DATA_TRANSFER_BYTES_PER_FRAME];
 } data_transfer;
 
-static void handle_frontend_data_transfers(void)
+static void end_data_transfer(void)
 {
-	if (!data_transfer.is_transfering) {
-		int buffer_index = get_written_buffer_index();
-		if (buffer_index < 0) {
-			// nothing to transfer
-			return;
-		}
-
-		memset(&data_transfer, 0, sizeof data_transfer);
-		data_transfer.is_transfering = 1;
-		data_transfer.buffer_index = buffer_index;
-		data_transfer.bytes_total = get_buffer_size(buffer_index);
-		printf("%s %d %s\n", CPPP_DATA_HEADER, data_transfer.bytes_total, get_buffer_filename(buffer_index));
-		adler32_init(&data_transfer.adler);
-	}
+	data_transfer.is_transfering = 0;
+	const struct batch_position* bp = get_buffer_batch_position(data_transfer.buffer_index);
+	const struct batch_position position = bp != NULL ? *bp : (struct batch_position){0};
+	release_buffer(data_transfer.buffer_index);
+	uint32_t checksum = adler32_sum(&data_transfer.adler);
+	printf("%s %.05d %lu\n", CPPP_DATA_FOOTER, data_transfer.sequence, checksum);
+	// buffers are transferred in the order they were written, i.e. batch order
+	if (bp != NULL) printf("%s %u %u %u\n", CPPP_BATCH_CHECKPOINT, position.cylinder, position.head, position.adjustment);
+}
 
-	if (!data_transfer.is_transfering) PANIC(PANIC_XXX);
+static void handle_text_data_transfer(void)
+{
 	for (int i = 0; i < DATA_TRANSFER_LINES_PER_CHUNK && data_transfer.is_transfering; i++) {
 		const int remaining = data_transfer.bytes_total - data_transfer.bytes_transferred;
 		const int n = remaining > DATA_TRANSFER_BYTES_PER_LINE ? DATA_TRANSFER_BYTES_PER_LINE : remaining;
@@ -151,10 +226,7 @@ static void handle_frontend_data_transfers(void)
 		puts(line);
 		data_transfer.bytes_transferred += n;
 		if (data_transfer.bytes_transferred == data_transfer.bytes_total) {
-			data_transfer.is_transfering = 0;
-			release_buffer(buffer_index);
-			uint32_t checksum = adler32_sum(&data_transfer.adler);
-			printf("%s %.05d %lu\n", CPPP_DATA_FOOTER, data_transfer.sequence, checksum);
+			end_data_transfer();
 			break;
 		} else if (data_transfer.bytes_transferred > data_transfer.bytes_total) {
 			PANIC(PANIC_XXX);
@@ -162,15 +234,265 @@ static void handle_frontend_data_transfers(void)
 	}
 }
 
+// writes the current frame directly to the CDC endpoint, bypassing stdio.
+// we're on the same core as printf() (which also ends up in tud_cdc_write())
+// so ordering with the F0/F2 lines is preserved. frames are written as far as
+// there's room in the TX FIFO (which is smaller than a frame); returns 0 if
+// the remainder must be written on the next call. until then nothing else may
+// print; see is_writing_frame().
+static int write_data_transfer_frame(void)
+{
+	while (data_transfer.frame_cursor < data_transfer.frame_size) {
+		const unsigned available = tud_cdc_write_available();
+		if (available == 0) return 0;
+		unsigned n = data_transfer.frame_size - data_transfer.frame_cursor;
+		if (n > available) n = available;
+		const unsigned written = tud_cdc_write(data_transfer.frame + data_transfer.frame_cursor, n);
+		data_transfer.frame_cursor += written;
+		if (written < n) return 0;
+	}
+	return 1;
+}
+
+// true while a frame is partially written; any text printed now would end up
+// inside it
+static int is_writing_frame(void)
+{
+	return data_transfer.is_transfering && data_transfer.frame_cursor < data_transfer.frame_size;
+}
+
+static void handle_binary_data_transfer(void)
+{
+	while (data_transfer.is_transfering) {
+		if (data_transfer.frame_cursor == data_transfer.frame_size) {
+			if (data_transfer.bytes_transferred == data_transfer.bytes_total) {
+				end_data_transfer();
+				break;
+			} else if (data_transfer.bytes_transferred > data_transfer.bytes_total) {
+				PANIC(PANIC_XXX);
+			}
+			const int remaining = data_transfer.bytes_total - data_transfer.bytes_transferred;
+			const int n = remaining > DATA_TRANSFER_BYTES_PER_FRAME ? DATA_TRANSFER_BYTES_PER_FRAME : remaining;
+			uint8_t* data = get_buffer_data(data_transfer.buffer_index) + data_transfer.bytes_transferred;
+			const uint32_t checksum = adler32(data, n);
+			adler32_append(&data_transfer.adler, checksum, n);
+			uint8_t* payload = xfer_frame_encode_header_checksum(data_transfer.frame, data_transfer.sequence++, n, checksum);
+			memcpy(payload, data, n);
+			data_transfer.frame_size = XFER_FRAME_HEADER_SIZE + n;
+			data_transfer.frame_cursor = 0;
+			data_transfer.bytes_transferred += n;
+		}
+		if (!write_data_transfer_frame()) break;
+	}
+	tud_cdc_write_flush();
+}
+
+static void end_raw_stream_transfer(void)
+{
+	data_transfer.is_transfering = 0;
+	uint32_t checksum = adler32_sum(&data_transfer.adler);
+	printf("%s %.05d %lu %u %d\n",
+		CPPP_RAW_FOOTER,
+		data_transfer.sequence,
+		checksum,
+		data_transfer.bytes_transferred,
+		raw_stream_has_overflowed());
+	raw_stream_end();
+}
+
+// like handle_binary_data_transfer(), but frames come from the raw stream
+// ring as the capture progresses; INDEX markers go out as lines between
+// frames
+static void handle_raw_stream_transfer(void)
+{
+	while (data_transfer.is_transfering) {
+		if (data_transfer.frame_cursor == data_transfer.frame_size) {
+			unsigned byte_offset;
+			while (raw_stream_pop_index(&byte_offset)) {
+				printf("%s %u\n", CPPP_RAW_INDEX, byte_offset);
+			}
+			if (raw_stream_is_done()) {
+				end_raw_stream_transfer();
+				break;
+			}
+			const uint8_t* data;
+			unsigned n = raw_stream_peek(&data);
+			if (n == 0) break;
+			if (n > DATA_TRANSFER_BYTES_PER_FRAME) n = DATA_TRANSFER_BYTES_PER_FRAME;
+			uint8_t* payload = data_transfer.frame + XFER_FRAME_HEADER_SIZE;
+			memcpy(payload, data, n);
+			// if the DMA lapped us while copying, the frame is
+			// garbage; drop it and let the footer report overflow
+			if (!raw_stream_consume(n)) break;
+			const uint32_t checksum = adler32(payload, n);
+			adler32_append(&data_transfer.adler, checksum, n);
+			xfer_frame_encode_header_checksum(data_transfer.frame, data_transfer.sequence, n, checksum);
+			data_transfer.sequence++;
+			data_transfer.frame_size = XFER_FRAME_HEADER_SIZE + n;
+			data_transfer.frame_cursor = 0;
+			data_transfer.bytes_transferred += n;
+		}
+		if (!write_data_transfer_frame()) break;
+	}
+	tud_cdc_write_flush();
+}
+
+static void begin_raw_stream_transfer(void)
+{
+	static unsigned serial;
+	memset(&data_transfer, 0, sizeof data_transfer);
+	data_transfer.is_transfering = 1;
+	data_transfer.is_binary = 1;
+	data_transfer.is_raw_stream = 1;
+	printf("%s raw%.4u.nrz\n", CPPP_RAW_HEADER, serial++);
+	adler32_init(&data_transfer.adler);
+}
+
+static void handle_frontend_data_transfers(void)
+{
+	if (!data_transfer.is_transfering && raw_stream_is_active()) {
+		begin_raw_stream_transfer();
+	}
+
+	if (!data_transfer.is_transfering) {
+		int buffer_index = get_written_buffer_index();
+		if (buffer_index < 0) {
+			// nothing to transfer
+			return;
+		}
+
+		memset(&data_transfer, 0, sizeof data_transfer);
+		data_transfer.is_transfering = 1;
+		data_transfer.is_binary = (transfer_mode == TRANSFER_MODE_BINARY);
+		data_transfer.buffer_index = buffer_index;
+		data_transfer.bytes_total = get_buffer_size(buffer_index);
+		printf("%s %d %s\n", CPPP_DATA_HEADER, data_transfer.bytes_total, get_buffer_filename(buffer_index));
+		uint32_t address_ok_mask, data_ok_mask;
+		const int n_sectors = get_buffer_sector_status(buffer_index, &address_ok_mask, &data_ok_mask);
+		if (n_sectors > 0) {
+			printf("%s %d %lu %lu\n", CPPP_SECTOR_CRC, n_sectors, address_ok_mask, data_ok_mask);
+		}
+		const uint8_t* attempts = get_buffer_sector_attempts(buffer_index);
+		if (n_sectors > 0 && attempts != NULL) {
+			printf("%s %d", CPPP_SECTOR_ATTEMPTS, n_sectors);
+			for (int i = 0; i < n_sectors; i++) printf(" %d", attempts[i]);
+			printf("\n");
+		}
+		const struct capture_telemetry* ct = get_buffer_capture_telemetry(buffer_index);
+		if (n_sectors > 0 && ct != NULL) {
+			printf("%s %lu %lu %lu %lu %lu %lu\n", CPPP_CAPTURE_TELEMETRY,
+				ct->n_captures, ct->fdebug, ct->n_words_missing, ct->n_pull_words_left, ct->total_us, ct->max_us);
+		}
+		adler32_init(&data_transfer.adler);
+	}
+
+	if (!data_transfer.is_transfering) PANIC(PANIC_XXX);
+	if (data_transfer.is_raw_stream) {
+		handle_raw_stream_transfer();
+	} else if (data_transfer.is_binary) {
+		handle_binary_data_transfer();
+	} else {
+		handle_text_data_transfer();
+	}
+}
+
+static void print_batch_stats(void)
+{
+	struct xop_batch_stats st;
+	xop_get_batch_stats(&st);
+	if (st.n_tracks == 0) return;
+	// elapsed revolutions include waiting for INDEX (and for buffers)
+	const double revolution_us = FREQ_IN_MICROS(DRIVE_RPS);
+	printf(CPPP_INFO "Batch: %u tracks; %u revolutions (%.2f per track; %.2f elapsed per track); %u tracks with bad sectors\n",
+		st.n_tracks,
+		st.n_revolutions,
+		(double)st.n_revolutions / (double)st.n_tracks,
+		((double)st.read_us / revolution_us) / (double)st.n_tracks,
+		st.n_bad_tracks);
+	if (st.n_seeks > 0) {
+		printf(CPPP_INFO "Batch: %u seeks, %u cylinders of travel; %.1fms seeking (estimated %.1fms)\n",
+			st.n_seeks,
+			st.seek_cylinders,
+			(double)st.seek_us * 1e-3,
+			(double)st.estimated_seek_us * 1e-3);
+	}
+	if (st.n_seek_fallbacks > 0 || st.n_stepped_seeks > 0) {
+		printf(CPPP_INFO "Batch: %u direct seeks failed (cleared with RTZ); %u seeks single-stepped\n",
+			st.n_seek_fallbacks,
+			st.n_stepped_seeks);
+	}
+	if (st.queue_unscheduled_seek_us > 0) {
+		printf(CPPP_INFO "Batch: elevator order: estimated %.1fms seeking for queued tracks (%.1fms in request order)\n",
+			(double)st.queue_estimated_seek_us * 1e-3,
+			(double)st.queue_unscheduled_seek_us * 1e-3);
+	}
+	if (st.n_unlabelled_reads > 0) {
+		printf(CPPP_INFO "Batch: %u reads could not be put in sector order (re-read from INDEX)\n", st.n_unlabelled_reads);
+	}
+	if (st.n_sync_retries > 0 || st.n_sync_give_ups > 0) {
+		printf(CPPP_INFO "Batch: %u fields hunted past a false SYNC candidate; %u fields without SYNC before the next SECTOR pulse\n",
+			st.n_sync_retries,
+			st.n_sync_give_ups);
+	}
+	if (st.n_revolutions > 0) {
+		printf(CPPP_INFO "Batch: capture path: %u RX FIFO stalls, %u pull-word underruns, %u incomplete captures; %.0fus per capture (max %luus)\n",
+			st.n_rx_stalls,
+			st.n_tx_stalls,
+			st.n_incomplete_captures,
+			(double)st.capture_us / (double)st.n_revolutions,
+			st.max_capture_us);
+	}
+	const uint64_t duration_us = xop_duration_us();
+	if (duration_us > 0) {
+		printf(CPPP_INFO "Batch: core1 idle %.1f%% of %.2fs (waiting for captures and drive status)\n",
+			100.0 * (double)st.idle_us / (double)duration_us,
+			(double)duration_us * 1e-6);
+	}
+}
+
+static void report_script_steps(void)
+{
+	struct xop_script_step_result sr;
+	while (xop_pop_script_step_result(&sr)) {
+		printf("%s %u %u %u %lu %u\n",
+			CPPP_SCRIPT_STEP,
+			sr.step,
+			sr.op,
+			XST_DONE,
+			sr.duration_us,
+			sr.result);
+	}
+}
+
+static void print_tag_timing(void)
+{
+	struct xop_tag_timing t;
+	xop_get_tag_timing(&t);
+	printf(CPPP_INFO "Tag timing: %luns setup, %luns hold\n", t.setup_ns, t.hold_ns);
+}
+
 static void handle_job_status(void)
 {
 	if (!is_job_polling) return;
+	// steps are pushed before the job finishes
 	enum xop_status st = poll_xop_status();
+	if (is_script_job) report_script_steps();
+	if (st >= XST_ERR0 && is_script_job) {
+		// the failed step is the one the job was at
+		const unsigned step = xop_script_get_current_step();
+		if (step < xop_script_get_n_steps()) {
+			printf("%s %u 0 %u %llu 0\n", CPPP_SCRIPT_STEP, step, st, xop_duration_us());
+		}
+	}
+	if (st == XST_DONE || st >= XST_ERR0) is_script_job = 0;
 	if (st == XST_DONE) {
 		printf(CPPP_INFO "Job OK! (took %llu microseconds)\n", xop_duration_us());
+		if (is_tag_calibration_job) print_tag_timing();
+		print_batch_stats();
 		is_job_polling = 0;
 	} else if (st >= XST_ERR0) {
 		printf(CPPP_INFO "Job FAILED! (error:%d, took %llu microseconds)\n", st, xop_duration_us());
+		print_batch_stats();
 		is_job_polling = 0;
 	}
 }
@@ -178,6 +500,17 @@ static void handle_job_status(void)
 static void job_begin(void)
 {
 	is_job_polling = 1;
+	is_script_job = 0;
+	is_tag_calibration_job = 0;
+}
+
+// cylinders from the host reach seek profiling and SYNC tuning, which index
+// tables by cylinder
+static int check_cylinder(unsigned cylinder)
+{
+	if (cylinder < DRIVE_CYLINDER_COUNT) return 1;
+	printf(CPPP_ERROR "cylinder %u out of range (%d cylinders)\n", cylinder, DRIVE_CYLINDER_COUNT);
+	return 0;
 }
 
 static int parse(void)
@@ -233,14 +566,17 @@ static int parse(void)
 		}
 	} break;
 	case COMMAND_xfer_test: {
-		if (!can_allocate_buffer()) {
+		unsigned size = command_parser.arguments[0].u;
+		if (is_job_polling) {
+			// jobs on core1 are the buffer producer; there can only be one
+			printf(CPPP_ERROR "cannot allocate buffer while a job is running\n");
+		} else if (!can_allocate_buffer(size)) {
 			printf(CPPP_ERROR "no buffer available\n");
 		} else {
-			unsigned size = command_parser.arguments[0].u;
 			const unsigned buffer_index = allocate_buffer(size);
 			char* s = get_buffer_filename(buffer_index);
 			snprintf(s, CLOCKED_READ_BUFFER_FILENAME_MAX_LENGTH, "_xfertest-bufidx%d-%dbytes.garbage", buffer_index, size);
-			size = get_buffer_size(buffer_index); // size can be truncated by MAX_DATA_BUFFER_SIZE
+			size = get_buffer_size(buffer_index); // size can be truncated by get_max_buffer_size()
 			uint8_t* p = get_buffer_data(buffer_index);
 			for (unsigned i = 0; i < size; i++) {
 				*(p++) = (i & 0xff) + ((i >> 8) & 0xff) + ((i >> 16) & 0xff) + ((i >> 24) & 0xff);
@@ -248,6 +584,145 @@ static int parse(void)
 			wrote_buffer(buffer_index);
 		}
 	} break;
+	case COMMAND_buffer_stats: {
+		struct buffer_stats st;
+		get_buffer_stats(&st);
+		printf(CPPP_INFO "buffers: %u/%u bytes used; high water mark %u bytes; %u allocations; %u producer stalls (%llu microseconds)\n",
+			st.bytes_used,
+			st.ring_size,
+			st.high_water_mark,
+			st.n_allocations,
+			st.n_producer_stalls,
+			st.producer_stall_us);
+	} break;
+	case COMMAND_base64_bench: {
+		// base64_encode() as handle_text_data_transfer() calls it, timed
+		// in system clock cycles with SysTick (24 bits)
+		static uint8_t input[DATA_TRANSFER_BYTES_PER_LINE*32];
+		static char output[DATA_TRANSFER_CHARACTERS_PER_LINE];
+		for (unsigned i = 0; i < sizeof input; i++) input[i] = i*7;
+		systick_hw->rvr = 0xffffff;
+		systick_hw->cvr = 0;
+		systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+		const uint32_t save = save_and_disable_interrupts();
+		const uint32_t t0 = systick_hw->cvr;
+		for (unsigned i = 0; i < sizeof input; i += DATA_TRANSFER_BYTES_PER_LINE) {
+			base64_encode(output, input + i, DATA_TRANSFER_BYTES_PER_LINE);
+		}
+		const uint32_t t1 = systick_hw->cvr;
+		restore_interrupts(save);
+		systick_hw->csr = 0;
+		const uint32_t cycles = (t0 - t1) & 0xffffff; // counts down
+		const uint32_t milli_bytes_per_cycle = (uint32_t)(((uint64_t)sizeof input * 1000) / cycles);
+		printf(CPPP_INFO "base64_encode: %u bytes in %lu cycles; %lu.%.3lu bytes/cycle\n",
+			(unsigned)sizeof input,
+			cycles,
+			milli_bytes_per_cycle / 1000,
+			milli_bytes_per_cycle % 1000);
+	} break;
+	case COMMAND_set_transfer_mode: {
+		const unsigned mode = command_parser.arguments[0].u;
+		if (mode != TRANSFER_MODE_TEXT && mode != TRANSFER_MODE_BINARY) {
+			printf(CPPP_ERROR "invalid transfer mode %d\n", mode);
+		} else {
+			// takes effect from the next transfer; an ongoing
+			// transfer completes in the mode it began in
+			transfer_mode = mode;
+			printf(CPPP_DEBUG "transfer mode = %d\n", transfer_mode);
+		}
+	} break;
+	case COMMAND_set_sector_layout: {
+		// <n sectors> <gap-a wait> <address size> <gap-b wait> <data size> <data tail> <sync> <sector number byte; -1=none>
+		// see struct cr8044read_layout
+		const struct cr8044read_layout layout = {
+			.n_sectors     = command_parser.arguments[0].u,
+			.gap_a_wait    = command_parser.arguments[1].u,
+			.address_size  = command_parser.arguments[2].u,
+			.gap_b_wait    = command_parser.arguments[3].u,
+			.data_size     = command_parser.arguments[4].u,
+			.data_tail     = command_parser.arguments[5].u,
+			.sync          = command_parser.arguments[6].u,
+			.sector_offset = command_parser.arguments[7].i,
+		};
+		if (is_job_polling) {
+			printf(CPPP_ERROR "cannot change sector layout while a job is running\n");
+		} else if (!cr8044read_set_layout(&layout)) {
+			printf(CPPP_ERROR "invalid sector layout\n");
+		} else {
+			// SYNC positions are relative to the layout's fields
+			sync_tune_reset();
+			printf(CPPP_INFO "sector layout: %u sectors; gap-a=%u, address=%u bytes, gap-b=%u, data=%u+%u bytes, sync=0x%.2x, sector number at byte %d; %u bytes per track\n",
+				layout.n_sectors,
+				layout.gap_a_wait,
+				layout.address_size,
+				layout.gap_b_wait,
+				layout.data_size,
+				layout.data_tail,
+				layout.sync,
+				layout.sector_offset,
+				cr8044read_get_capture_size());
+		}
+	} break;
+	case COMMAND_sync_histograms: {
+		// histograms are written by batch reads on core1
+		if (is_job_polling) {
+			printf(CPPP_ERROR "cannot read SYNC histograms while a job is running\n");
+			break;
+		}
+		for (unsigned head = 0; head < DRIVE_HEAD_COUNT; head++) {
+			for (unsigned zone = 0; zone < SYNC_TUNE_N_ZONES; zone++) {
+				for (int field = 0; field < SYNC_N_FIELDS; field++) {
+					const struct sync_histogram* h = sync_tune_get_histogram(head, zone, field);
+					printf("%s %u %u %u %d %u %u %lu %u",
+						CPPP_SYNC_HISTOGRAM,
+						head,
+						zone,
+						(zone * DRIVE_CYLINDER_COUNT + SYNC_TUNE_N_ZONES - 1) / SYNC_TUNE_N_ZONES,
+						field,
+						sync_tune_get_origin(field),
+						SYNC_TUNE_BIN_WIDTH,
+						h->n_samples,
+						sync_tune_get_zone_wait(head, zone, field));
+					for (int i = 0; i < SYNC_TUNE_N_BINS; i++) printf(" %u", h->counts[i]);
+					printf("\n");
+				}
+			}
+		}
+		if (command_parser.arguments[0].u) sync_tune_reset();
+		printf(CPPP_INFO "SYNC histograms done\n");
+	} break;
+	case COMMAND_seek_profile: {
+		// written by seeks on core1
+		if (is_job_polling) {
+			printf(CPPP_ERROR "cannot read seek profile while a job is running\n");
+			break;
+		}
+		for (unsigned band = 0; band < SEEK_PROFILE_N_BANDS; band++) {
+			const unsigned first = seek_profile_get_band_first_distance(band);
+			for (int direction = 0; direction < SEEK_N_DIRECTIONS; direction++) {
+				const struct seek_profile_entry* e = seek_profile_get_entry(band, direction);
+				printf("%s %u %u %d %lu %lu",
+					CPPP_SEEK_PROFILE,
+					first,
+					2*first-1,
+					direction,
+					e->n_errors,
+					e->n_unseen_responses);
+				const struct seek_timing* timings[] = { &e->response, &e->seek };
+				for (int i = 0; i < 2; i++) {
+					const struct seek_timing* t = timings[i];
+					printf(" %lu %lu %lu %lu",
+						t->n,
+						t->min_us,
+						t->n > 0 ? (uint32_t)(t->sum_us / t->n) : 0,
+						t->max_us);
+				}
+				printf("\n");
+			}
+		}
+		if (command_parser.arguments[0].u) seek_profile_reset();
+		printf(CPPP_INFO "seek profile done\n");
+	} break;
 	case COMMAND_loopback_test: {
 		uint n_bytes = command_parser.arguments[0].u;
 		printf(CPPP_INFO "firing loopback test with %d bytes\n", n_bytes);
@@ -259,8 +734,8 @@ static int parse(void)
 	} break;
 	case COMMAND_op_reset: {
 		job_begin();
+		xop_reset(); // stops core1 (the buffer producer) before resetting buffers
 		reset_buffers();
-		xop_reset();
 	} break;
 	case COMMAND_op_blink_test: {
 		const int fail = command_parser.arguments[0].u;
@@ -277,10 +752,12 @@ static int parse(void)
 		xop_select_unit0();
 	} break;
 	case COMMAND_op_select_cylinder: {
+		if (!check_cylinder(command_parser.arguments[0].u)) break;
 		job_begin();
 		xop_select_cylinder(command_parser.arguments[0].u);
 	} break;
 	case COMMAND_op_broken_seek: {
+		if (!check_cylinder(command_parser.arguments[0].u)) break;
 		job_begin();
 		xop_broken_seek(command_parser.arguments[0].u);
 	} break;
@@ -289,15 +766,18 @@ static int parse(void)
 		xop_select_head(command_parser.arguments[0].u);
 	} break;
 	case COMMAND_op_read_data: {
-		if (!can_allocate_buffer()) {
-			printf(CPPP_ERROR "no buffer available\n");
+		// streams directly to the frontend (see raw_stream.h), so it
+		// must not queue up behind buffer transfers
+		if (transfer_mode != TRANSFER_MODE_BINARY) {
+			printf(CPPP_ERROR "raw reads require binary transfer mode\n");
+		} else if (data_transfer.is_transfering || raw_stream_is_active() || get_written_buffer_index() >= 0) {
+			printf(CPPP_ERROR "cannot start raw read while transfers are pending\n");
 		} else {
 			job_begin();
-			unsigned buffer_index = xop_read_data(
+			xop_read_data(
 				command_parser.arguments[0].u,
 				command_parser.arguments[1].u,
 				command_parser.arguments[2].u);
-			printf(CPPP_DEBUG "reading into buffer %d\n", buffer_index);
 		}
 	} break;
 	case COMMAND_op_read_batch: {
@@ -307,8 +787,64 @@ static int parse(void)
 		const unsigned n_32bit_words  = command_parser.arguments[3].u;
 		const int servo_offset        = command_parser.arguments[4].i;
 		const int data_strobe_delay   = command_parser.arguments[5].i;
+		const unsigned max_retries    = command_parser.arguments[6].u;
+		const unsigned flags          = command_parser.arguments[7].u;
+		if (!check_cylinder(cylinder0) || !check_cylinder(cylinder1)) break;
+		job_begin();
+		xop_read_batch(cylinder0, cylinder1, head_set, n_32bit_words, servo_offset, data_strobe_delay, max_retries, flags);
+	} break;
+	case COMMAND_op_resume_batch: {
+		#define ARG(I) command_parser.arguments[I]
+		if (!check_cylinder(ARG(0).u) || !check_cylinder(ARG(1).u)) break;
 		job_begin();
-		xop_read_batch(cylinder0, cylinder1, head_set, n_32bit_words, servo_offset, data_strobe_delay);
+		xop_resume_batch(ARG(0).u, ARG(1).u, ARG(2).u, ARG(3).u, ARG(4).i, ARG(5).i, ARG(6).u, ARG(7).u, ARG(8).u, ARG(9).u);
+		#undef ARG
+	} break;
+	case COMMAND_op_calibrate_tag_timing: {
+		job_begin();
+		is_tag_calibration_job = 1;
+		xop_calibrate_tag_timing();
+	} break;
+	case COMMAND_set_tag_timing: {
+		// 0 for the default; jobs pick it up when they start
+		const unsigned setup_ns = command_parser.arguments[0].u;
+		const unsigned hold_ns  = command_parser.arguments[1].u;
+		if (setup_ns > TAG_TIMING_DEFAULT_NS || hold_ns > TAG_TIMING_DEFAULT_NS) {
+			printf(CPPP_ERROR "tag timing above %dns\n", TAG_TIMING_DEFAULT_NS);
+			break;
+		}
+		const struct xop_tag_timing t = {
+			.setup_ns = setup_ns > 0 ? setup_ns : TAG_TIMING_DEFAULT_NS,
+			.hold_ns  = hold_ns  > 0 ? hold_ns  : TAG_TIMING_DEFAULT_NS,
+		};
+		xop_set_tag_timing(&t);
+		print_tag_timing();
+	} break;
+	case COMMAND_script_clear: {
+		if (is_job_polling) {
+			printf(CPPP_ERROR "cannot change the script while a job is running\n");
+			break;
+		}
+		xop_script_clear();
+	} break;
+	case COMMAND_script_append: {
+		if (is_job_polling) {
+			printf(CPPP_ERROR "cannot change the script while a job is running\n");
+			break;
+		}
+		uint8_t* end = base64_decode_line(script_upload_buffer, (char*)command_parser.arguments[0].s);
+		if (end == NULL) {
+			printf(CPPP_ERROR "could not decode script steps\n");
+		} else if (!xop_script_append(script_upload_buffer, end - script_upload_buffer)) {
+			printf(CPPP_ERROR "invalid script steps, or more than %d steps\n", SCRIPT_MAX_STEPS);
+		} else {
+			printf(CPPP_DEBUG "script: %u steps\n", xop_script_get_n_steps());
+		}
+	} break;
+	case COMMAND_op_run_script: {
+		job_begin();
+		is_script_job = 1;
+		xop_run_script();
 	} break;
 	default: {
 		printf(CPPP_ERROR "unhandled command %s/%d\n",
@@ -321,6 +857,8 @@ static int parse(void)
 
 int main()
 {
+	init_buffers(); // takes the RAM that's left; must come first
+
 	// I/O pin config
 	gpio_init(LED_PIN);
 	gpio_set_dir(LED_PIN, GPIO_OUT);
@@ -337,21 +875,38 @@ int main()
 	#undef PIN
 
 	//clocked_read_init(pio0,  /*dma_channel=*/0);
-	cr8044read_init(pio0,        /*dma_channels=*/0,1);
+	cr8044read_init(pio0,        /*dma_channels=*/0,1, /*crc_dma_channel=*/3);
 	loopback_test_prep(pio1, /*dma_channel=*/2);
+	raw_stream_init(pio1,    /*dma_channel=*/4);
+	cr8044read_init_sync_timer(pio1, /*dma_channel=*/5);
+	spindle_timing_init(pio1);
+	{ // status pin changes are recorded by core0's GPIO interrupt
+		uint32_t status_gpio_mask = 0;
+		#define PIN(TYPE,NAME,GPN) if (TYPE==STATUS) status_gpio_mask |= (1<<GPN);
+		EMIT_PIN_CONFIG
+		#undef PIN
+		pin_events_init(status_gpio_mask);
+	}
 
 	stdio_init_all();
 
 	blink(50, 0); // "Hi, we're up!"
 
 	for (;;) {
-		for (int i = 0; i < 50; i++) {
-			if (!parse()) break;
+		spindle_timing_poll();
+		// everything that prints waits while a binary frame is
+		// partially written (the frontend would see text inside it)
+		if (!is_writing_frame()) {
+			for (int i = 0; i < 50; i++) {
+				if (!parse()) break;
+			}
+			status_housekeeping();
 		}
-		status_housekeeping();
 		handle_frontend_data_transfers();
-		handle_job_status();
-		loopback_test_tick();
+		if (!is_writing_frame()) {
+			handle_job_status();
+			loopback_test_tick();
+		}
 		//tight_loop_contents(); // does nothing
 		tud_task(); // tinyusb work
 	}
@@ -8,6 +8,7 @@
 // with one char for each argument:
 //   - b: boolean (unsigned/uint32_t)
 //   - u: unsigned/uint32_t
+//   - s: string (const char*); must be the last argument
 // The controller sends messages:
 //   - if it begins with "[" it's a log message
 //   - otherwise it's a payload; see CPPP_* below
@@ -19,6 +20,12 @@
 	COMMAND(set_ctrl,                 "u"        ) \
 	COMMAND(led,                      "b"        ) \
 	COMMAND(xfer_test,                "u"        ) \
+	COMMAND(set_transfer_mode,        "u"        ) \
+	COMMAND(buffer_stats,             ""         ) \
+	COMMAND(base64_bench,             ""         ) \
+	COMMAND(set_sector_layout,        "uuuuuuui" ) \
+	COMMAND(sync_histograms,          "b"        ) \
+	COMMAND(seek_profile,             "b"        ) \
 	COMMAND(loopback_test,            "u"        ) \
 	COMMAND(terminate_op,             ""         ) \
 	COMMAND(op_reset,                 ""         ) \
@@ -29,16 +36,42 @@
 	COMMAND(op_broken_seek,           "u"        ) \
 	COMMAND(op_select_head,           "u"        ) \
 	COMMAND(op_read_data,             "uuu"      ) \
-	COMMAND(op_read_batch,            "uuuuii"   )
+	COMMAND(op_read_batch,            "uuuuiiuu" ) \
+	COMMAND(op_resume_batch,          "uuuuiiuuuu") \
+	COMMAND(op_calibrate_tag_timing,  ""         ) \
+	COMMAND(set_tag_timing,           "uu"       ) \
+	COMMAND(script_clear,             ""         ) \
+	COMMAND(script_append,            "s"        ) \
+	COMMAND(op_run_script,            ""         )
 
 // controller protocol payload prefixes: response from controller should begin
 // with one of these
-#define CPPP_FREQ               "HZ"
+#define CPPP_FREQ               "HZ" // <0=INDEX 1=SECTOR> <frequency in mHz>
+#define CPPP_REVOLUTION         "RV" // <n revolutions> <mean period ns> <min ns> <max ns> <stddev ns> <n dropped>; INDEX periods since the last CPPP_FREQ; see spindle_timing.h
 #define CPPP_STATUS             "ST"
+#define CPPP_STATUS_EVENTS      "SE" // <n lost> [<timestamp us> <status> [<us since previous> <status>]...]; status changes in order, every edge; n lost>0: ring overflowed before these (a CPPP_STATUS follows)
 #define CPPP_TIME               "TI"
 #define CPPP_DATA_HEADER        "F0"
 #define CPPP_DATA_LINE          "F1"
 #define CPPP_DATA_FOOTER        "F2"
+#define CPPP_SECTOR_CRC         "SC" // <n sectors> <address ok mask> <data ok mask>; follows CPPP_DATA_HEADER
+#define CPPP_SECTOR_ATTEMPTS    "SA" // <n sectors> <attempts for sector 0> <...1> ...; 0=never read OK; follows CPPP_SECTOR_CRC
+#define CPPP_CAPTURE_TELEMETRY  "CT" // <n captures> <fdebug> <words missing> <pull words left> <total us> <max us>; follows CPPP_SECTOR_CRC; see struct capture_telemetry
+#define CPPP_SYNC_HISTOGRAM    "SH" // <head> <zone> <first cylinder> <field 0=address 1=data> <origin> <bin width> <n samples> <tuned wait; 0=none> <count for bin 0> <...1> ...; see sync_tune.h
+#define CPPP_SEEK_PROFILE      "SP" // <first distance> <last distance> <direction 0=forward 1=reverse> <n errors> <n unseen responses> <n responses> <min us> <mean us> <max us> <n seeks> <min us> <mean us> <max us>; see seek_profile.h
+#define CPPP_BATCH_CHECKPOINT  "BC" // <cylinder> <head> <adjustment>; after CPPP_DATA_FOOTER of a batch track: it and all tracks before it are transferred; op_resume_batch continues after it
+#define CPPP_SCRIPT_STEP       "SS" // <step> <op> <status> <duration us> <result>; one per script step (see EMIT_SCRIPT_OPS); status is XST_DONE or the job error
+#define CPPP_RAW_HEADER         "R0" // <filename>; raw stream (op_read_data) follows as xfer_frame.h frames
+#define CPPP_RAW_INDEX          "RI" // <byte offset>; INDEX pulse position in raw stream
+#define CPPP_RAW_FOOTER         "R2" // <sequence> <adler32> <n bytes> <overflowed>
+// (with TRANSFER_MODE_BINARY, CPPP_DATA_LINE is replaced by binary frames; see
+// xfer_frame.h)
+// PIO FDEBUG bits in CPPP_CAPTURE_TELEMETRY (as if captured by state machine 0)
+#define CAPTURE_FDEBUG_RXSTALL (1 << 0)  // RX FIFO full; bits were lost
+#define CAPTURE_FDEBUG_RXUNDER (1 << 8)
+#define CAPTURE_FDEBUG_TXOVER  (1 << 16)
+#define CAPTURE_FDEBUG_TXSTALL (1 << 24) // pull words ran dry; gate timing slipped
+#define CAPTURE_FDEBUG_MASK    (CAPTURE_FDEBUG_RXSTALL | CAPTURE_FDEBUG_RXUNDER | CAPTURE_FDEBUG_TXOVER | CAPTURE_FDEBUG_TXSTALL)
 #define CPPP_LOG "["
 #define CPPP_ERROR   CPPP_LOG"ERROR] "
 #define CPPP_WARNING CPPP_LOG"WARNING] "
@@ -102,11 +135,77 @@ enum tag3bit {
 
 #define MAX_DATA_BUFFER_SIZE (9+551+1)*32 // XXX should match cr8044read.h
 
+enum transfer_mode {
+	TRANSFER_MODE_TEXT   = 0, // base64 CPPP_DATA_LINE lines
+	TRANSFER_MODE_BINARY = 1, // xfer_frame.h frames
+};
+
+enum batch_flags {
+	BATCH_FLAG_PIPELINED  = 1<<0, // capture consecutive heads on back-to-back revolutions
+	BATCH_FLAG_ANY_SECTOR = 1<<1, // start captures at next SECTOR instead of INDEX; device rotates tracks into sector order
+	BATCH_FLAG_AUTO_TUNE  = 1<<2, // use gap waits derived from measured SYNC positions (sync_tune.h)
+};
+
 enum adjustment {
 	MINUS   = -1,
 	NEUTRAL =  0,
 	PLUS    =  1,
 	ENTIRE_RANGE = 101,
+	ADAPTIVE     = 102, // start at neutral, escalate on CRC failure
+};
+
+// Job scripts: a list of steps that core1 executes in order as one job, so
+// that e.g. an arbitrary list of tracks (or a list of tracks to re-read) needs
+// no host round trips. Steps are SCRIPT_STEP_SIZE bytes, <op> <a> <b (16-bit
+// little endian)>, and are uploaded base64 encoded with script_append (as
+// many lines as needed) and run with op_run_script.
+#define SCRIPT_STEP_SIZE (4)
+#define SCRIPT_MAX_STEPS (1024)
+#define EMIT_SCRIPT_OPS                                                                                     \
+	SCRIPT_OP(SEEK,            1, "b=cylinder (see SET_SEEK_MODE)"                                  ) \
+	SCRIPT_OP(SELECT_HEAD,     2, "a=head"                                                          ) \
+	SCRIPT_OP(SET_ADJUSTMENT,  3, "a=servo offset, b=data strobe delay (-1, 0, 1 or ADAPTIVE; signed)") \
+	SCRIPT_OP(SET_RETRIES,     4, "b=max retries for READ_TRACK"                                   ) \
+	SCRIPT_OP(SET_FLAGS,       5, "b=batch_flags for READ_TRACK (BATCH_FLAG_PIPELINED is ignored)" ) \
+	SCRIPT_OP(READ_TRACK,      6, "a=head; reads a track at the current cylinder; result=sectors OK") \
+	SCRIPT_OP(WAIT_MS,         7, "b=milliseconds"                                                  ) \
+	SCRIPT_OP(WAIT_INDEX,      8, "b=number of INDEX pulses"                                        ) \
+	SCRIPT_OP(RETURN_TO_ZERO,  9, ""                                                                ) \
+	SCRIPT_OP(SET_SEEK_MODE,  10, "b=enum seek_mode for SEEK and SERVE_QUEUE"                       ) \
+	SCRIPT_OP(QUEUE_TRACK,    11, "a=SCRIPT_TRACK_A(head, adjustment), b=cylinder; read by SERVE_QUEUE") \
+	SCRIPT_OP(SERVE_QUEUE,    12, "reads queued tracks in elevator order; reports each as its QUEUE_TRACK step")
+
+// QUEUE_TRACK's `a`: head in bits 0-2, servo offset+1 in bits 3-4, data strobe
+// delay+1 in bits 5-6, and bit 7 for ADAPTIVE (both)
+#define SCRIPT_TRACK_A(head, servo_offset, data_strobe_delay) \
+	((head) | (((servo_offset)+1) << 3) | (((data_strobe_delay)+1) << 5))
+#define SCRIPT_TRACK_A_ADAPTIVE(head) ((head) | (1 << 7))
+
+// tag timing (set_tag_timing): the default is also the maximum
+#define TAG_TIMING_DEFAULT_NS (10000)
+
+enum seek_mode {
+	SEEK_MODE_NORMAL      = 0, // one seek (TAG1) per cylinder change
+	SEEK_MODE_SINGLE_STEP = 1, // "broken seek": one cylinder at a time; for drives that can't coarse seek
+	SEEK_MODE_HYBRID      = 2, // NORMAL, falling back to SINGLE_STEP on SEEK_ERROR (remembered per distance)
+};
+
+enum script_op {
+	#define SCRIPT_OP(NAME,VALUE,DESC) SCRIPT_OP_ ## NAME = VALUE,
+	EMIT_SCRIPT_OPS
+	#undef SCRIPT_OP
+};
+
+// job status (see poll_xop_status()); also the status in CPPP_SCRIPT_STEP
+enum xop_status {
+	XST_RUNNING               = 0,
+	XST_DONE                  = 1,
+	XST_ERR0                  = 1000,
+	XST_ERR_DRIVE_ERROR       = 1001,
+	XST_ERR_DRIVE_NOT_READY   = 1002,
+	XST_ERR_OVERFLOW          = 1003, // raw stream consumer fell behind
+	XST_ERR_TIMEOUT           = 1999,
+	XST_ERR_TEST              = 2001,
 };
 
 #define CONTROLLER_PROTOCOL_H
@@ -30,12 +30,16 @@ points.
 */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "pico/time.h"
 
 #include "cr8044read.h"
 #include "cr8044read.pio.h"
+#include "sync_timer.pio.h"
 #include "pin_config.h"
 #include "base.h"
 #include "controller_protocol.h"
@@ -45,28 +49,71 @@ _Static_assert(cr8044read_READ_CLOCK  == GPIO_READ_CLOCK);
 _Static_assert(cr8044read_INDEX       == GPIO_INDEX);
 _Static_assert(cr8044read_SECTOR      == GPIO_SECTOR);
 _Static_assert(cr8044read_SERVO_CLOCK == GPIO_SERVO_CLOCK);
+_Static_assert(sync_timer_READ_DATA   == GPIO_READ_DATA);
+_Static_assert(sync_timer_READ_CLOCK  == GPIO_READ_CLOCK);
+_Static_assert(sync_timer_READ_GATE   == GPIO_BIT1);
+_Static_assert(CR8044READ_MAX_SECTORS <= 32, "sector masks are 32-bit");
+_Static_assert(CR8044READ_BYTES_TOTAL <= CR8044READ_MAX_BYTES_TOTAL);
 
 static PIO pio;
 static uint sm;
 static uint dma_channel;
 static uint dma_channel2;
+static uint crc_dma_channel;
+static uint8_t crc_dma_sink;
 static uint pc_offset;
 
-#define N_PULL_WORDS_PER_SECTOR (4)
-#define N_PULL_WORDS (N_PULL_WORDS_PER_SECTOR * CR8044READ_N_SECTORS)
+#define N_PULL_WORDS_PER_FIELD (3)
+#define N_PULL_WORDS_PER_SECTOR (2*N_PULL_WORDS_PER_FIELD)
+#define MAX_PULL_WORDS (N_PULL_WORDS_PER_SECTOR * CR8044READ_MAX_SECTORS)
 
-static unsigned pull_words[N_PULL_WORDS];
+static unsigned pull_words[MAX_PULL_WORDS];
+static unsigned n_pull_words;
+static unsigned n_capture_words;
+static struct cr8044read_layout layout;
+static unsigned gap_a_wait; // active gap waits; see cr8044read_set_gap_waits()
+static unsigned gap_b_wait;
+static unsigned n_sync_retries;
+
+static int has_sync_timer;
+static PIO timer_pio;
+static uint timer_sm;
+static uint timer_dma_channel;
+static uint timer_pc_offset;
+
+// captures waiting for the previous one to complete; the one at queue_head is
+// being captured
+struct queued_capture {
+	uint8_t* dst;
+	enum cr8044read_start_mode mode;
+	uint32_t t0;
+	unsigned n_sync_give_ups;
+	struct cr8044read_telemetry telemetry; // set on completion
+	int has_sync_delays; // set on completion
+	// sync_timer.pio output: zero bits before the first 1-bit, and the first
+	// SYNC hunt window, for each field
+	uint32_t sync_delays[4*CR8044READ_MAX_SECTORS];
+};
+static struct queued_capture queue[CR8044READ_MAX_QUEUED_CAPTURES];
+static volatile unsigned queue_head;
+static volatile unsigned queue_tail;
+static void capture_done_irq_handler(void);
+static struct cr8044read_telemetry last_telemetry;
+static int has_last_sync_offsets;
+static uint16_t last_address_sync_offsets[CR8044READ_MAX_SECTORS];
+static uint16_t last_data_sync_offsets[CR8044READ_MAX_SECTORS];
 
 static inline void cr8044read_program_init(PIO pio, uint sm, uint pc_offset)
 {
 	pio_sm_config cfg = cr8044read_program_get_default_config(pc_offset);
 	sm_config_set_in_pins(&cfg, GPIO_READ_DATA);
-	sm_config_set_set_pins(&cfg, GPIO_BIT1, 1);
+	sm_config_set_sideset_pins(&cfg, GPIO_BIT1);
+	sm_config_set_jmp_pin(&cfg, GPIO_SECTOR);
 
 	pio_sm_set_consecutive_pindirs(pio, sm, GPIO_BIT1,   /*pin_count=*/1, /*is_out=*/true);
 
 	sm_config_set_in_shift(&cfg, /*shift_right=*/true, /*autopush=*/true, /*push_threshold=*/32);
-	sm_config_set_out_shift(&cfg, /*shift_right=*/false, /*autopull=*/false, /*pull_threshold=*/32);
+	sm_config_set_out_shift(&cfg, /*shift_right=*/false, /*autopull=*/true, /*pull_threshold=*/32);
 	sm_config_set_fifo_join(&cfg, PIO_FIFO_JOIN_NONE);
 
 	pio_sm_init(pio, sm, pc_offset, &cfg);
@@ -80,90 +127,592 @@ static inline uint cr8044read_program_add_and_get_sm(PIO pio)
 	return sm;
 }
 
-void cr8044read_init(PIO _pio, uint _dma_channel, uint _dma_channel2)
+static unsigned get_sector_stride(const struct cr8044read_layout* l)
+{
+	return l->address_size + l->data_size + l->data_tail;
+}
+
+// the PIO reads each field to the end of its last 32-bit word (the ISR must be
+// empty when hunting for the next SYNC); cr8044read_unpack() removes the
+// padding
+static unsigned get_field_span(unsigned n_bytes)
+{
+	return (n_bytes + 3) & ~3;
+}
+
+static unsigned get_packed_sector_stride(const struct cr8044read_layout* l)
+{
+	return get_field_span(l->address_size) + get_field_span(l->data_size + l->data_tail);
+}
+
+static unsigned* put_field_pull_words(unsigned* wp, unsigned gap_wait, unsigned n_bytes, int is_last_in_sector)
 {
+	// these are loaded into the PIO X-register and used for loop
+	// counting. since loops are "repeat and decrement if non-zero", the
+	// value must be one smaller than the intended iteration count.
+	*(wp++) = gap_wait - 1;
+	*(wp++) = 8*(get_field_span(n_bytes) - 1) - 1; // SYNC is read by the hunt
+	*(wp++) = is_last_in_sector;
+	return wp;
+}
+
+static unsigned get_address_pad_bits(const struct cr8044read_layout* l)
+{
+	return 8*(get_field_span(l->address_size) - l->address_size);
+}
+
+// The address field's padding is read from Gap-B with read gate still on, so
+// the gap-b wait (read gate off) is shortened by as much. This keeps the data
+// field's SYNC hunt starting where the layout says, but does NOT keep read
+// gate timing: for CR8044 (9 address bytes padded to 12) read gate stays on
+// through the first 24 bits of Gap-B, and with the default wait of 32 it's
+// only off for 8 SERVO_CLOCK cycles instead of 32. That's still short of the
+// ~30 bit "inversion point", but hasn't been tried on a drive. The wait must
+// exceed the padding (see gap_b_wait_is_valid()).
+static unsigned get_padded_gap_b_wait(const struct cr8044read_layout* l, unsigned gap_b_wait)
+{
+	return gap_b_wait - get_address_pad_bits(l);
+}
+
+static int gap_b_wait_is_valid(const struct cr8044read_layout* l, unsigned gap_b_wait)
+{
+	return gap_b_wait > get_address_pad_bits(l);
+}
+
+static void put_pull_words(const struct cr8044read_layout* l, unsigned gap_a_wait, unsigned gap_b_wait)
+{
+	const unsigned padded_gap_b_wait = get_padded_gap_b_wait(l, gap_b_wait);
 	unsigned* wp = pull_words;
-	const unsigned n_address_bits = 8*9;
-	const unsigned gap_a_wait = 32;
-	const unsigned gap_b_wait = 32;
-	const unsigned n_data_bits = (((CR8044READ_DATA_SIZE+3)>>2) << 5);
-	for (int i0 = 0; i0 < CR8044READ_N_SECTORS; i0++) {
-		// these are loaded into the PIO X-register and used for loop
-		// counting. since loops are "repeat and decrement if
-		// non-zero", the value must be one smaller than the intended
-		// iteration count.
-		*(wp++) = gap_a_wait - 1;
-		*(wp++) = n_address_bits - 1;
-		*(wp++) = gap_b_wait - 1;
-		*(wp++) = n_data_bits - 1;
-	}
-	if ((wp-pull_words) != N_PULL_WORDS) PANIC(PANIC_UNEXPECTED_STATE);
-	pio = _pio;
-	dma_channel = _dma_channel;
-	dma_channel2 = _dma_channel2;
-	sm = cr8044read_program_add_and_get_sm(pio);
+	for (int i = 0; i < l->n_sectors; i++) {
+		wp = put_field_pull_words(wp, gap_a_wait, l->address_size, 0);
+		wp = put_field_pull_words(wp, padded_gap_b_wait, l->data_size + l->data_tail, 1);
+	}
+	n_pull_words = wp - pull_words;
+	if (n_pull_words > MAX_PULL_WORDS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
 }
 
-void cr8044read_execute(uint8_t* dst)
+int cr8044read_set_layout(const struct cr8044read_layout* l)
 {
-	pio_sm_set_enabled(pio, sm, false);
+	if (l->n_sectors < 1 || l->n_sectors > CR8044READ_MAX_SECTORS) return 0;
+	if (l->gap_a_wait < 1 || l->gap_b_wait < 1) return 0;
+	if (l->address_size < 1 || l->data_size < 1) return 0;
+	// each field is bounded before anything is added or multiplied, so
+	// neither the rounding nor the stride can wrap
+	if (l->address_size > CR8044READ_MAX_BYTES_TOTAL) return 0;
+	if (l->data_size > CR8044READ_MAX_BYTES_TOTAL || l->data_tail > CR8044READ_MAX_BYTES_TOTAL) return 0;
+	if (l->data_size + l->data_tail > CR8044READ_MAX_BYTES_TOTAL) return 0;
+	if (l->n_sectors * get_packed_sector_stride(l) > CR8044READ_MAX_BYTES_TOTAL) return 0;
+	if (l->sync > 0xff) return 0;
+	if (l->sector_offset < -1 || l->sector_offset >= (int)l->address_size) return 0;
+	if (!gap_b_wait_is_valid(l, l->gap_b_wait)) return 0;
 
-	pio_gpio_init(pio, GPIO_BIT1);
+	put_pull_words(l, l->gap_a_wait, l->gap_b_wait);
+	n_capture_words = (l->n_sectors * get_packed_sector_stride(l)) >> 2;
+	layout = *l;
+	gap_a_wait = l->gap_a_wait;
+	gap_b_wait = l->gap_b_wait;
+	return 1;
+}
 
-	pio_sm_clear_fifos(pio, sm);
-	pio_sm_restart(pio, sm);
-	pio_sm_exec(pio, sm, pio_encode_jmp(pc_offset));
+int cr8044read_set_gap_waits(unsigned _gap_a_wait, unsigned _gap_b_wait)
+{
+	if (queue_head != queue_tail) PANIC(PANIC_UNEXPECTED_STATE);
+	if (_gap_a_wait < 1 || !gap_b_wait_is_valid(&layout, _gap_b_wait)) return 0;
+	if (_gap_a_wait == gap_a_wait && _gap_b_wait == gap_b_wait) return 1;
+	put_pull_words(&layout, _gap_a_wait, _gap_b_wait);
+	gap_a_wait = _gap_a_wait;
+	gap_b_wait = _gap_b_wait;
+	return 1;
+}
+
+void cr8044read_get_gap_waits(unsigned* _gap_a_wait, unsigned* _gap_b_wait)
+{
+	*_gap_a_wait = gap_a_wait;
+	*_gap_b_wait = gap_b_wait;
+}
 
-	const int word_32bit_count = (CR8044READ_BYTES_TOTAL + 3) >> 2;
+const struct cr8044read_layout* cr8044read_get_layout(void)
+{
+	return &layout;
+}
+
+unsigned cr8044read_get_sector_stride(void)
+{
+	return get_sector_stride(&layout);
+}
+
+unsigned cr8044read_get_capture_size(void)
+{
+	return n_capture_words << 2;
+}
+
+unsigned cr8044read_get_unpacked_size(void)
+{
+	return (layout.n_sectors * get_sector_stride(&layout) + 3) & ~3;
+}
+
+unsigned cr8044read_get_n_sync_retries(void)
+{
+	return n_sync_retries;
+}
+
+static void sync_give_up_irq_handler(void);
+
+static uint get_pio_irq(void)
+{
+	return pio_get_index(pio) ? PIO1_IRQ_0 : PIO0_IRQ_0;
+}
+
+uint32_t cr8044read_get_all_sectors_mask(void)
+{
+	return layout.n_sectors == 32 ? CR8044READ_ALL_SECTORS_MASK : ((1u << layout.n_sectors) - 1);
+}
+
+void cr8044read_init(PIO _pio, uint _dma_channel, uint _dma_channel2, uint _crc_dma_channel)
+{
+	const struct cr8044read_layout cr8044 = {
+		.n_sectors     = CR8044READ_N_SECTORS,
+		.gap_a_wait    = 32,
+		.address_size  = CR8044READ_ADDRESS_CRC_SIZE,
+		.gap_b_wait    = 32,
+		.data_size     = CR8044READ_DATA_CRC_SIZE,
+		.data_tail     = CR8044READ_DATA_SIZE - CR8044READ_DATA_CRC_SIZE,
+		.sync          = CR8044READ_SYNC,
+		.sector_offset = CR8044READ_ADDRESS_SECTOR_OFFSET,
+	};
+	if (!cr8044read_set_layout(&cr8044)) PANIC(PANIC_UNEXPECTED_STATE);
+	pio = _pio;
+	dma_channel = _dma_channel;
+	dma_channel2 = _dma_channel2;
+	crc_dma_channel = _crc_dma_channel;
+	sm = cr8044read_program_add_and_get_sm(pio);
+
+	// enabled on the core that starts captures, like DMA_IRQ_1
+	pio_interrupt_clear(pio, cr8044read_SYNC_GIVE_UP_IRQ);
+	pio_set_irq0_source_enabled(pio, pis_interrupt0 + cr8044read_SYNC_GIVE_UP_IRQ, true);
+	irq_set_exclusive_handler(get_pio_irq(), sync_give_up_irq_handler);
+
+	irq_set_exclusive_handler(DMA_IRQ_1, capture_done_irq_handler);
+	dma_channel_set_irq1_enabled(dma_channel, true);
 
 	{
-		dma_channel_config dma_channel_cfg = dma_channel_get_default_config(dma_channel);
-		channel_config_set_read_increment(&dma_channel_cfg,  false);
-		channel_config_set_write_increment(&dma_channel_cfg, true);
-		channel_config_set_dreq(&dma_channel_cfg, pio_get_dreq(pio, sm, false));
+		dma_channel_config cfg = dma_channel_get_default_config(dma_channel);
+		channel_config_set_read_increment(&cfg,  false);
+		channel_config_set_write_increment(&cfg, true);
+		channel_config_set_dreq(&cfg, pio_get_dreq(pio, sm, false));
 		dma_channel_configure(
 			dma_channel,
-			&dma_channel_cfg,
-			dst,
+			&cfg,
+			NULL,                      // set by cr8044read_start()
 			&pio->rxf[sm],             // read from PIO RX FIFO
-			word_32bit_count,
-			true // start now!
+			n_capture_words,
+			false
 		);
 	}
 
 	{
-		dma_channel_config dma_channel2_cfg = dma_channel_get_default_config(dma_channel2);
-		channel_config_set_read_increment(&dma_channel2_cfg,  true);
-		channel_config_set_write_increment(&dma_channel2_cfg, false);
-		channel_config_set_dreq(&dma_channel2_cfg, pio_get_dreq(pio, sm, true));
+		dma_channel_config cfg = dma_channel_get_default_config(dma_channel2);
+		channel_config_set_read_increment(&cfg,  true);
+		channel_config_set_write_increment(&cfg, false);
+		channel_config_set_dreq(&cfg, pio_get_dreq(pio, sm, true));
 		dma_channel_configure(
 			dma_channel2,
-			&dma_channel2_cfg,
+			&cfg,
 			&pio->txf[sm],             // write to PIO TX FIFO
 			pull_words,
-			N_PULL_WORDS,
-			true // start now!
+			n_pull_words,
+			false
 		);
 	}
+}
+
+void cr8044read_init_sync_timer(PIO _pio, uint _dma_channel)
+{
+	if (_pio == pio) PANIC(PANIC_UNEXPECTED_STATE);
+	timer_pio = _pio;
+	timer_dma_channel = _dma_channel;
+	timer_pc_offset = pio_add_program(timer_pio, &sync_timer_program);
+	timer_sm = pio_claim_unused_sm(timer_pio, true);
+
+	pio_sm_config cfg = sync_timer_program_get_default_config(timer_pc_offset);
+	sm_config_set_jmp_pin(&cfg, GPIO_READ_DATA);
+	sm_config_set_fifo_join(&cfg, PIO_FIFO_JOIN_RX);
+	pio_sm_init(timer_pio, timer_sm, timer_pc_offset, &cfg);
+
+	dma_channel_config dcfg = dma_channel_get_default_config(timer_dma_channel);
+	channel_config_set_read_increment(&dcfg,  false);
+	channel_config_set_write_increment(&dcfg, true);
+	channel_config_set_dreq(&dcfg, pio_get_dreq(timer_pio, timer_sm, false));
+	dma_channel_configure(
+		timer_dma_channel,
+		&dcfg,
+		NULL,                            // set by arm()
+		&timer_pio->rxf[timer_sm],       // read from PIO RX FIFO
+		0,
+		false
+	);
+	has_sync_timer = 1;
+}
+
+// (re)starts the PIO program and re-arms the DMA channels (configured by
+// cr8044read_init()) for the part of a capture into `dst` from sector slot
+// `slot` on. slot 0 waits for INDEX/SECTOR as the capture's mode says; later
+// slots start right away (see sync_give_up_irq_handler())
+static void arm_at(struct queued_capture* c, unsigned slot)
+{
+	pio_sm_set_enabled(pio, sm, false);
+
+	pio_sm_clear_fifos(pio, sm);
+	pio_sm_restart(pio, sm);
+	pio_interrupt_clear(pio, cr8044read_SYNC_GIVE_UP_IRQ);
+	pio_sm_set_pins_with_mask(pio, sm, 0, 1u << GPIO_BIT1); // read gate off
+	// Y holds the SYNC byte as it appears in the ISR after 8 bits
+	pio_sm_put(pio, sm, layout.sync << 24);
+	pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+	pio_sm_exec(pio, sm, pio_encode_out(pio_y, 32));
+	const uint entry =
+		slot > 0                                ? cr8044read_offset_field :
+		c->mode == CR8044READ_START_AT_SECTOR   ? cr8044read_offset_sector_start :
+		0;
+	pio_sm_exec(pio, sm, pio_encode_jmp(pc_offset + entry));
+
+	const unsigned sector_words = get_packed_sector_stride(&layout) >> 2;
+	const unsigned n_pull_words_skipped = slot * N_PULL_WORDS_PER_SECTOR;
+	dma_channel_transfer_to_buffer_now(dma_channel, (uint32_t*)c->dst + slot*sector_words, n_capture_words - slot*sector_words);
+	dma_channel_transfer_from_buffer_now(dma_channel2, pull_words + n_pull_words_skipped, n_pull_words - n_pull_words_skipped);
 
 	pio_sm_set_enabled(pio, sm, true);
+}
+
+static void arm(struct queued_capture* c)
+{
+	pio_sm_set_enabled(pio, sm, false);
+	pio->fdebug = (CAPTURE_FDEBUG_MASK << sm); // write 1 to clear
+
+	if (has_sync_timer) {
+		// waits for read gate to go low first, so it can't start mid-field
+		pio_sm_set_enabled(timer_pio, timer_sm, false);
+		pio_sm_clear_fifos(timer_pio, timer_sm);
+		pio_sm_restart(timer_pio, timer_sm);
+		pio_sm_exec(timer_pio, timer_sm, pio_encode_jmp(timer_pc_offset));
+		dma_channel_transfer_to_buffer_now(timer_dma_channel, c->sync_delays, 4*layout.n_sectors);
+		pio_sm_set_enabled(timer_pio, timer_sm, true);
+	}
+
+	c->n_sync_give_ups = 0;
+	c->t0 = time_us_32();
+	arm_at(c, 0);
+}
+
+// stops the capture DMA channels
+static void abort_dma(void)
+{
+	// aborting raises a spurious completion interrupt (RP2040-E13)
+	dma_channel_set_irq1_enabled(dma_channel, false);
+	dma_channel_abort(dma_channel);
+	dma_channel_abort(dma_channel2);
+	dma_channel_acknowledge_irq1(dma_channel);
+	dma_channel_set_irq1_enabled(dma_channel, true);
+}
+
+static void get_telemetry(const struct queued_capture* c, struct cr8044read_telemetry* t)
+{
+	t->fdebug = (pio->fdebug >> sm) & CAPTURE_FDEBUG_MASK;
+	t->n_words_missing = dma_channel_hw_addr(dma_channel)->transfer_count;
+	t->n_pull_words_left = dma_channel_hw_addr(dma_channel2)->transfer_count;
+	t->duration_us = time_us_32() - c->t0;
+	t->n_sync_retries = 0; // counted on completion, from the sync delays
+	t->n_sync_give_ups = c->n_sync_give_ups;
+}
+
+// the capture at queue_head is done; records its telemetry and starts the
+// next queued capture
+static void finish_capture(struct queued_capture* c)
+{
+	get_telemetry(c, &c->telemetry);
+	// one word pair per field; the last was pushed a data field ago. after
+	// a give-up the sync timer's words no longer line up with the fields
+	c->has_sync_delays =
+		has_sync_timer
+		&& c->n_sync_give_ups == 0
+		&& dma_channel_hw_addr(timer_dma_channel)->transfer_count == 0;
+	if (c->has_sync_delays) {
+		for (int i = 0; i < 2*layout.n_sectors; i++) {
+			if (c->sync_delays[2*i+1] != (layout.sync << 24)) c->telemetry.n_sync_retries++;
+		}
+		n_sync_retries += c->telemetry.n_sync_retries;
+	}
+	queue_head++;
+	if (queue_head != queue_tail) {
+		arm(&queue[queue_head % CR8044READ_MAX_QUEUED_CAPTURES]);
+	} else {
+		pio_sm_set_enabled(pio, sm, false);
+		if (has_sync_timer) pio_sm_set_enabled(timer_pio, timer_sm, false);
+	}
+}
 
-	absolute_time_t t0 = get_absolute_time();
-	while (dma_channel_is_busy(dma_channel)) {
-		absolute_time_t dt = get_absolute_time() - t0;
-		// NOTE: job should take at most 1/60 seconds
-		if (dt > 500000LL) {
-			printf(CPPP_INFO "ERROR: cr8044read_execute() stalled // FDEBUG=%lu FSTAT=%lu ADDR=%lu\n",
+// the capture DMA completing (i.e. the last data field being captured)
+// chains the next queued capture
+static void capture_done_irq_handler(void)
+{
+	if ((dma_hw->ints1 & (1u << dma_channel)) == 0) return;
+	dma_channel_acknowledge_irq1(dma_channel);
+	if (queue_head == queue_tail) return; // stale; see cr8044read_abort()
+	finish_capture(&queue[queue_head % CR8044READ_MAX_QUEUED_CAPTURES]);
+}
+
+// the SYNC hunt ran into the next SECTOR pulse without finding SYNC; the PIO
+// waits on SYNC_GIVE_UP_IRQ. the rest of the sector's slot is left empty and
+// the capture resumes at the next sector, which that pulse started. resuming
+// takes a few µs, which comes out of the next sector's Gap-A
+static void sync_give_up_irq_handler(void)
+{
+	if (!pio_interrupt_get(pio, cr8044read_SYNC_GIVE_UP_IRQ)) return;
+	if (queue_head == queue_tail) {
+		pio_interrupt_clear(pio, cr8044read_SYNC_GIVE_UP_IRQ); // stale; see cr8044read_abort()
+		return;
+	}
+	struct queued_capture* c = &queue[queue_head % CR8044READ_MAX_QUEUED_CAPTURES];
+	c->n_sync_give_ups++;
+
+	// the PIO has stopped pushing; let the capture DMA take what it pushed
+	while (!pio_sm_is_rx_fifo_empty(pio, sm)) tight_loop_contents();
+	pio_sm_set_enabled(pio, sm, false);
+	const unsigned n_written = n_capture_words - dma_channel_hw_addr(dma_channel)->transfer_count;
+	abort_dma();
+
+	// nothing in the rest of the slot can pass the SYNC check
+	const unsigned sector_words = get_packed_sector_stride(&layout) >> 2;
+	const unsigned slot = n_written / sector_words;
+	const unsigned slot_end = (slot + 1) * sector_words;
+	memset(c->dst + 4*n_written, ~layout.sync, 4*(slot_end - n_written));
+
+	if (slot + 1 < layout.n_sectors) {
+		arm_at(c, slot + 1);
+	} else {
+		finish_capture(c);
+		c->telemetry.n_words_missing = 0; // the empty slot isn't missing
+	}
+}
+
+void cr8044read_start(uint8_t* dst, enum cr8044read_start_mode mode)
+{
+	// completion interrupts are taken by the core that starts captures
+	irq_set_enabled(DMA_IRQ_1, true);
+	irq_set_enabled(get_pio_irq(), true);
+
+	const uint32_t save = save_and_disable_interrupts();
+	if ((queue_tail - queue_head) >= CR8044READ_MAX_QUEUED_CAPTURES) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	const int was_idle = (queue_head == queue_tail);
+	struct queued_capture* c = &queue[queue_tail % CR8044READ_MAX_QUEUED_CAPTURES];
+	c->dst = dst;
+	c->mode = mode;
+	queue_tail++;
+	if (was_idle) {
+		pio_gpio_init(pio, GPIO_BIT1);
+		arm(c);
+	}
+	restore_interrupts(save);
+}
+
+int cr8044read_is_busy(void)
+{
+	return queue_head != queue_tail;
+}
+
+void cr8044read_get_telemetry(struct cr8044read_telemetry* telemetry)
+{
+	*telemetry = last_telemetry;
+}
+
+unsigned cr8044read_get_n_queued(void)
+{
+	return queue_tail - queue_head;
+}
+
+void cr8044read_abort(void)
+{
+	pio_sm_set_enabled(pio, sm, false);
+	abort_dma();
+	pio_interrupt_clear(pio, cr8044read_SYNC_GIVE_UP_IRQ);
+	if (has_sync_timer) {
+		pio_sm_set_enabled(timer_pio, timer_sm, false);
+		dma_channel_abort(timer_dma_channel);
+	}
+	queue_head = queue_tail;
+
+	// reset the effect of calling pio_gpio_init() in cr8044read_start() so
+	// that software can drive these pins again
+	gpio_set_function(GPIO_BIT1, GPIO_FUNC_SIO);
+}
+
+// converts sync_timer.pio counts (zero bits after read gate on) to offsets
+// from where the gap waits start
+static void set_last_sync_offsets(const struct queued_capture* c)
+{
+	has_last_sync_offsets = c->has_sync_delays;
+	if (!has_last_sync_offsets) return;
+	const unsigned data_origin = get_address_pad_bits(&layout) + get_padded_gap_b_wait(&layout, gap_b_wait);
+	const uint32_t sync = layout.sync << 24;
+	const uint32_t max = CR8044READ_SYNC_OFFSET_UNKNOWN - 1;
+	for (int i = 0; i < layout.n_sectors; i++) {
+		// the counts are only where SYNC was found if the hunt accepted
+		// its first window
+		const uint32_t a = gap_a_wait  + c->sync_delays[4*i];
+		const uint32_t d = data_origin + c->sync_delays[4*i+2];
+		last_address_sync_offsets[i] = c->sync_delays[4*i+1] != sync ? CR8044READ_SYNC_OFFSET_UNKNOWN : a > max ? max : a;
+		last_data_sync_offsets[i]    = c->sync_delays[4*i+3] != sync ? CR8044READ_SYNC_OFFSET_UNKNOWN : d > max ? max : d;
+	}
+}
+
+int cr8044read_get_sync_offsets(uint16_t* address_offsets, uint16_t* data_offsets)
+{
+	if (!has_last_sync_offsets) return 0;
+	memcpy(address_offsets, last_address_sync_offsets, layout.n_sectors * sizeof *address_offsets);
+	memcpy(data_offsets,    last_data_sync_offsets,    layout.n_sectors * sizeof *data_offsets);
+	return 1;
+}
+
+void cr8044read_wait(void)
+{
+	if (queue_head == queue_tail) return;
+	const unsigned n = queue_head + 1;
+	const struct queued_capture* c = &queue[queue_head % CR8044READ_MAX_QUEUED_CAPTURES];
+	// NOTE: a capture should take at most 1/60 seconds (plus up to one
+	// revolution waiting for INDEX)
+	const absolute_time_t deadline = make_timeout_time_us(500000);
+	while ((int)(queue_head - n) < 0) {
+		if (best_effort_wfe_or_timeout(deadline) && (int)(queue_head - n) < 0) {
+			get_telemetry(c, &last_telemetry);
+			has_last_sync_offsets = 0;
+			printf(CPPP_INFO "ERROR: cr8044read_wait() stalled // FDEBUG=%lu FSTAT=%lu ADDR=%lu\n",
 				pio->fdebug,
 				pio->fstat,
 				pio->sm[sm].addr
 				);
-			break;
+			cr8044read_abort();
+			return;
 		}
 	}
-	pio_sm_set_enabled(pio, sm, false);
+	last_telemetry = c->telemetry;
+	set_last_sync_offsets(c);
+	if (queue_head == queue_tail) {
+		gpio_set_function(GPIO_BIT1, GPIO_FUNC_SIO);
+	}
+}
 
-	// reset the effect of calling pio_gpio_init() above so that software
-	// can drive these pins again
-	gpio_set_function(GPIO_BIT1, GPIO_FUNC_SIO);
+void cr8044read_execute(uint8_t* dst)
+{
+	cr8044read_start(dst, CR8044READ_START_AT_INDEX);
+	cr8044read_wait();
+	cr8044read_unpack(dst);
+}
+
+void cr8044read_unpack(uint8_t* buf)
+{
+	const unsigned data_n = layout.data_size + layout.data_tail;
+	const unsigned address_span = get_field_span(layout.address_size);
+	const unsigned data_span = get_field_span(data_n);
+	if (address_span == layout.address_size && data_span == data_n) return;
+	// fields only move towards the start of the buffer
+	uint8_t* wp = buf;
+	const uint8_t* rp = buf;
+	for (int i = 0; i < layout.n_sectors; i++) {
+		memmove(wp, rp, layout.address_size);
+		wp += layout.address_size;
+		rp += address_span;
+		memmove(wp, rp, data_n);
+		wp += data_n;
+		rp += data_span;
+	}
+}
+
+// Runs `n` bytes through a byte-wide DMA transfer to nowhere with the sniffer
+// enabled. CRC16R is CRC-16-CCITT (0x1021) with each byte fed LSB first,
+// which matches the bit order of captures (and bits_crc16() in misc/bits.h
+// on LSB-first data). A field including its CRC yields zero if it's intact.
+static uint16_t sniff_crc16(const uint8_t* src, unsigned n)
+{
+	dma_channel_config cfg = dma_channel_get_default_config(crc_dma_channel);
+	channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
+	channel_config_set_read_increment(&cfg,  true);
+	channel_config_set_write_increment(&cfg, false);
+	channel_config_set_sniff_enable(&cfg, true);
+	dma_sniffer_enable(crc_dma_channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC16R, true);
+	dma_hw->sniff_data = 0;
+	dma_channel_configure(
+		crc_dma_channel,
+		&cfg,
+		&crc_dma_sink,
+		src,
+		n,
+		true // start now!
+	);
+	dma_channel_wait_for_finish_blocking(crc_dma_channel);
+	return dma_hw->sniff_data & 0xffff;
+}
+
+void cr8044read_verify(const uint8_t* src, uint32_t* address_ok_mask, uint32_t* data_ok_mask)
+{
+	uint32_t address_ok = 0;
+	uint32_t data_ok = 0;
+	const uint8_t* p = src;
+	const unsigned stride = get_sector_stride(&layout);
+	const int sector_offset = layout.sector_offset;
+	for (int i = 0; i < layout.n_sectors; i++, p += stride) {
+		const uint8_t* data = p + layout.address_size;
+		// intact fields from another sector (e.g. in a slot that fell
+		// behind) are not ok; an unreadable address can't tell
+		const int address_intact = (p[0] == layout.sync && sniff_crc16(p, layout.address_size) == 0);
+		const int wrong_sector = address_intact && sector_offset >= 0 && p[sector_offset] != i;
+		if (address_intact && !wrong_sector) {
+			address_ok |= (1 << i);
+		}
+		if (!wrong_sector && data[0] == layout.sync && sniff_crc16(data, layout.data_size) == 0) {
+			data_ok |= (1 << i);
+		}
+	}
+	*address_ok_mask = address_ok;
+	*data_ok_mask = data_ok;
+}
+
+static void reverse_bytes(uint8_t* p, unsigned n)
+{
+	uint8_t* q = p + n - 1;
+	while (p < q) {
+		const uint8_t tmp = *p;
+		*(p++) = *q;
+		*(q--) = tmp;
+	}
+}
+
+int cr8044read_rotate_to_index(uint8_t* buf)
+{
+	// find sector number of first slot from the first address field that
+	// passes CRC; all other good address fields must agree
+	const int n_sectors = layout.n_sectors;
+	const unsigned stride = get_sector_stride(&layout);
+	if (layout.sector_offset < 0) return -1;
+	int first_sector = -1;
+	const uint8_t* p = buf;
+	for (int i = 0; i < n_sectors; i++, p += stride) {
+		if (sniff_crc16(p, layout.address_size) != 0) continue;
+		const int sector = p[layout.sector_offset];
+		if (sector >= n_sectors) return -1;
+		const int s0 = (sector - i + n_sectors) % n_sectors;
+		if (first_sector == -1) {
+			first_sector = s0;
+		} else if (s0 != first_sector) {
+			return -1;
+		}
+	}
+	if (first_sector <= 0) return first_sector;
+
+	// rotate right by first_sector slots (in place; rotating by reversal)
+	const unsigned n = n_sectors * stride;
+	const unsigned k = (n_sectors - first_sector) * stride;
+	reverse_bytes(buf, k);
+	reverse_bytes(buf + k, n - k);
+	reverse_bytes(buf, n);
+	return first_sector;
 }
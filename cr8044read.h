@@ -16,7 +16,8 @@
 // Both address and data fields start with a SYNC byte (10111001).
 
 // Gap-A comes immediately after a SECTOR pulse, but in practice the timing of
-// the address SYNC varies by ~60 bits.
+// the address SYNC varies by ~60 bits (sync_tune.h keeps histograms of where
+// it actually is).
 
 // The CR8044 controller (most likely) only wrote the data field when writing
 // data to a sector, starting the write-stream somewhere in Gap-B.
@@ -32,10 +33,13 @@
 // So, the attempted solution for reading is:
 //  after INDEX pulse:
 //  - enable read
-//  - wait for READ_DATA to go high (first bit in SYNC byte)
-//  - read 9 bytes (address field), clocked by READ_CLOCK
+//  - hunt for the SYNC byte: starting at each 1-bit, read 8 bits and compare
+//    them with SYNC (a noise bit in the gap costs 8 bits, not the field); at
+//    the next SECTOR pulse, give up and leave the sector's slot empty
+//  - read 9 bytes (address field, including SYNC), clocked by READ_CLOCK,
+//    plus 24 bits of Gap-B that pad it to whole 32-bit words
 //  - disable read
-//  - wait M bits, clocked by SERVO_CLOCK
+//  - wait M-24 bits, clocked by SERVO_CLOCK
 //  - enable read
 //  - read 511+1 bytes (data field), clocked by READ_CLOCK
 //  - disable read
@@ -43,7 +47,10 @@
 //  - repeat
 
 // M should be somewhere between 30 and 77. 30 is the "inversion point", and
-// past 77 the drive no longer has 75 zero bits for sync.
+// past 77 the drive no longer has 75 zero bits for sync. The layout's waits
+// are conservative defaults; with BATCH_FLAG_AUTO_TUNE batch reads use the
+// waits sync_tune.c derives from measured SYNC positions instead (see
+// cr8044read_set_gap_waits()).
 
 // XXX should match controller_protocol.h
 #define CR8044READ_ADDRESS_SIZE (9)
@@ -51,12 +58,140 @@
 #define CR8044READ_BYTES_PER_SECTOR (CR8044READ_ADDRESS_SIZE+CR8044READ_DATA_SIZE)
 #define CR8044READ_N_SECTORS (32) // XXX read a little more
 #define CR8044READ_BYTES_TOTAL (CR8044READ_N_SECTORS * CR8044READ_BYTES_PER_SECTOR)
+#define CR8044READ_ALL_SECTORS_MASK (0xffffffff)
+#define CR8044READ_SYNC (0x9D) // 10111001, LSB first
+
+// limits for struct cr8044read_layout
+#define CR8044READ_MAX_SECTORS     (32) // sector masks are 32-bit
+#define CR8044READ_MAX_BYTES_TOTAL (20<<10)
+
+#define CR8044READ_MAX_QUEUED_CAPTURES (4)
 
 #include <stdint.h>
 #include "hardware/pio.h"
 
-void cr8044read_init(PIO _pio, uint _dma_channel, uint _dma_channel2);
+// Sector layout used by the field-gated reader; defaults to CR8044 (above).
+// Any format with the same SECTOR-gap-address-gap-data structure can be read
+// by uploading another layout (COMMAND set_sector_layout). Gaps are counted in
+// SERVO_CLOCK cycles (read disabled); fields in bytes (read enabled, starting
+// at SYNC).
+struct cr8044read_layout {
+	unsigned n_sectors;
+	unsigned gap_a_wait;   // after SECTOR/INDEX, until address field
+	unsigned address_size; // SYNC+address+CRC
+	unsigned gap_b_wait;   // after address field, until data field
+	unsigned data_size;    // SYNC+data+CRC
+	unsigned data_tail;    // bytes read after data field that aren't covered by CRC (CR8044: EOS)
+	unsigned sync;         // first byte of both fields
+	int sector_offset;     // address field byte holding the 0-based sector number (CR8044: CR8044READ_ADDRESS_SECTOR_OFFSET); -1=none
+};
+
+// Captured sectors are CR8044READ_BYTES_PER_SECTOR apart; the address field
+// comes first, followed by the data field. Bits are stored LSB first.
+#define CR8044READ_ADDRESS_CRC_SIZE (9)   // SYNC+address+CRC
+#define CR8044READ_DATA_CRC_SIZE    (551) // SYNC+data+CRC
+// address field: SYNC, cylinder (16 bits), head, sector, auxiliary (16 bits),
+// CRC (16 bits); see misc/cr80_extract.c
+#define CR8044READ_ADDRESS_SECTOR_OFFSET (4)
+
+enum cr8044read_start_mode {
+	CR8044READ_START_AT_INDEX = 0,
+	// Capture begins at whichever sector comes next, which removes ~half a
+	// revolution of rotational latency on average. The capture then holds
+	// a layout's worth of consecutive sectors that wrap around INDEX (this
+	// assumes the drive also pulses SECTOR for sector 0);
+	// cr8044read_rotate_to_index() puts them back in order.
+	CR8044READ_START_AT_SECTOR = 1,
+};
+
+void cr8044read_init(PIO _pio, uint _dma_channel, uint _dma_channel2, uint _crc_dma_channel);
+// Optional: runs sync_timer.pio on `pio` (must not be the reader's PIO, which
+// is full) so that captures also record SYNC positions; see
+// cr8044read_get_sync_offsets().
+void cr8044read_init_sync_timer(PIO pio, uint dma_channel);
+// returns 0 (and keeps the current layout) if `layout` is out of bounds (this
+// includes a gap-b wait that doesn't exceed the address field's padding); must
+// not be called while a capture is running. Also resets the gap waits to the
+// layout's.
+int cr8044read_set_layout(const struct cr8044read_layout* layout);
+const struct cr8044read_layout* cr8044read_get_layout(void);
+// Overrides the layout's gap waits for subsequent captures without changing
+// the layout; returns 0 if a wait is out of bounds (see
+// cr8044read_set_layout()). Must not be called while
+// a capture is running or queued.
+int cr8044read_set_gap_waits(unsigned gap_a_wait, unsigned gap_b_wait);
+void cr8044read_get_gap_waits(unsigned* gap_a_wait, unsigned* gap_b_wait);
+// The PIO pads each field to a whole number of 32-bit words, so a capture
+// needs cr8044read_get_capture_size() bytes. cr8044read_unpack() removes the
+// padding in place, after which sectors are cr8044read_get_sector_stride()
+// apart and the capture is cr8044read_get_unpacked_size() bytes (rounded up to
+// a whole number of words).
+unsigned cr8044read_get_sector_stride(void);
+unsigned cr8044read_get_capture_size(void);
+unsigned cr8044read_get_unpacked_size(void);
+void cr8044read_unpack(uint8_t* buf);
+// total number of fields whose SYNC hunt rejected the first 8-bit window (a
+// false SYNC candidate; each rejected window skips 8 bits). Counted from
+// sync_timer.pio's output, so only captures with complete sync timer output
+// count.
+unsigned cr8044read_get_n_sync_retries(void);
+uint32_t cr8044read_get_all_sectors_mask(void);
 void cr8044read_execute(uint8_t* dst);
+// cr8044read_execute() (minus unpacking) split in two; cr8044read_start()
+// arms PIO/DMA (which then wait for the next INDEX) and returns immediately.
+// cr8044read_wait() returns as soon as the last data field has been captured,
+// i.e. in the last sector's Gap-C, leaving just enough time to select another
+// head before the next INDEX.
+// Captures started while one is running are queued (at most
+// CR8044READ_MAX_QUEUED_CAPTURES including the running one); the DMA
+// completion interrupt starts the next one right away, so queued captures of
+// the same head run on back-to-back revolutions. cr8044read_wait() waits for
+// the oldest capture, sleeping (WFE) until the interrupt; completion
+// interrupts are taken by the core that calls cr8044read_start().
+void cr8044read_start(uint8_t* dst, enum cr8044read_start_mode mode);
+int cr8044read_is_busy(void);
+unsigned cr8044read_get_n_queued(void);
+void cr8044read_wait(void);
+// Recorded for each capture when it completes (or stalls): FDEBUG bits show
+// whether the PIO ever stalled on a full RX FIFO (bits lost) or an empty TX
+// FIFO (gate timing slipped), and DMA transfer counts remaining show how much
+// a stalled capture is missing.
+struct cr8044read_telemetry {
+	uint32_t fdebug;            // CAPTURE_FDEBUG_* (controller_protocol.h)
+	uint32_t n_words_missing;   // capture DMA words remaining
+	uint32_t n_pull_words_left; // pull-word DMA words remaining
+	uint32_t duration_us;       // from arming (including waiting for INDEX/SECTOR)
+	uint32_t n_sync_retries;    // see cr8044read_get_n_sync_retries()
+	uint32_t n_sync_give_ups;   // fields whose SYNC hunt ran into the next SECTOR pulse (slot left empty)
+};
+// telemetry of the capture the last cr8044read_wait() waited for
+void cr8044read_get_telemetry(struct cr8044read_telemetry* telemetry);
+// SYNC positions of the capture the last cr8044read_wait() waited for, by
+// capture slot (i.e. before cr8044read_rotate_to_index()), in bits: address
+// SYNC from the SECTOR (or INDEX) pulse, and data SYNC from the end of the
+// address field. Positions are where the first 1-bit after read gate on was;
+// fields where that wasn't SYNC (the hunt went on) are
+// CR8044READ_SYNC_OFFSET_UNKNOWN. Returns 0 if they weren't recorded (no sync
+// timer, or the capture stalled or gave up on a field).
+#define CR8044READ_SYNC_OFFSET_UNKNOWN (0xffff)
+int cr8044read_get_sync_offsets(uint16_t* address_offsets, uint16_t* data_offsets);
+// stops the running capture and drops queued ones; also safe to call from the
+// other core once the capturing core is down
+void cr8044read_abort(void);
+// Checks CRC-16-CCITT of each address and data field in an unpacked capture
+// (using the DMA sniffer); bit N in the masks is set if sector N is OK, which
+// also requires the field to begin with the layout's SYNC byte, and, if the
+// layout has a sector number, the address field to carry sector number N (a
+// data field behind an intact address field with another number fails too),
+// so that a sector captured into the wrong slot never passes. Expects sector
+// 0 first (i.e. CR8044READ_START_AT_SECTOR captures rotated).
+void cr8044read_verify(const uint8_t* src, uint32_t* address_ok_mask, uint32_t* data_ok_mask);
+// Rotates an unpacked CR8044READ_START_AT_SECTOR capture so that sector 0 comes first.
+// Sectors are labelled by the sector number in address fields that pass CRC.
+// Returns the sector the capture started at, or -1 if it can't be determined
+// (the layout has no sector number, no good address field, or they
+// disagree), in which case `buf` is left as is.
+int cr8044read_rotate_to_index(uint8_t* buf);
 
 #define CR8044READ_H
 #endif
@@ -17,6 +17,10 @@
 #endif
 #define DRIVE_HEAD_COUNT          (5)
 
+// seek times from the CDC 9762 specifications; only used for estimates
+#define DRIVE_SEEK_MIN_US         (6000)  // one cylinder
+#define DRIVE_SEEK_MAX_US         (55000) // full stroke
+
 // NOTE: sector count depends on dip switches on the drive itself; these define
 // how many clock cycles a sector consists of, and therefore how often the
 // SECTOR impulse is sent.
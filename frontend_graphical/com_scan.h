@@ -0,0 +1,185 @@
+#ifndef COM_SCAN_H
+
+// Splits the controller's byte stream into text lines and binary frames (see
+// xfer_frame.h) in place: lines and frames that are entirely inside a read
+// buffer are handed over where they are (a line is NUL-terminated by
+// overwriting its CR/LF), and only the one that straddles the end of a buffer
+// is copied, to `carry`. Lines are found with memchr(), which is vectorized
+// in any libc worth having.
+//
+// Also has allocation-free parsing of the integers/tokens in a line.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "xfer_frame.h"
+
+#define COM_SCAN_MAX_LINE (1<<12)
+#define COM_SCAN_CARRY_SIZE (XFER_FRAME_HEADER_SIZE + XFER_FRAME_MAX_PAYLOAD > COM_SCAN_MAX_LINE ? XFER_FRAME_HEADER_SIZE + XFER_FRAME_MAX_PAYLOAD : COM_SCAN_MAX_LINE)
+
+struct com_scan_handlers {
+	void(*line)(void* ctx, char* line); // NUL-terminated, non-empty, may be modified
+	void(*frame)(void* ctx, const struct xfer_frame_header*, const uint8_t* payload);
+	void(*bad_frame)(void* ctx, const struct xfer_frame_header*);
+};
+
+struct com_scan {
+	uint8_t carry[COM_SCAN_CARRY_SIZE];
+	unsigned n_carry;
+	int carry_is_frame;
+	int is_dropping_line; // longer than COM_SCAN_MAX_LINE; skipped up to its end
+	unsigned n_overlong_lines;
+};
+
+// first CR or LF in [p;end), or NULL
+static inline char* com_scan__find_eol(char* p, char* end)
+{
+	char* lf = (char*)memchr(p, '\n', end - p);
+	char* cr = (char*)memchr(p, '\r', (lf != NULL ? lf : end) - p);
+	return cr != NULL ? cr : lf;
+}
+
+// consumes carried frame bytes from [p;end); returns new p
+static inline char* com_scan__frame(struct com_scan* cs, char* p, char* end, const struct com_scan_handlers* h, void* ctx)
+{
+	struct xfer_frame_header header;
+	for (;;) {
+		const int has_header = cs->n_carry >= XFER_FRAME_HEADER_SIZE;
+		unsigned need = XFER_FRAME_HEADER_SIZE;
+		if (has_header) {
+			if (!xfer_frame_decode_header(cs->carry, &header)) {
+				h->bad_frame(ctx, &header);
+				cs->n_carry = 0;
+				cs->carry_is_frame = 0;
+				return p;
+			}
+			need += header.length;
+		}
+		unsigned n = need - cs->n_carry;
+		if (n > (unsigned)(end - p)) n = end - p;
+		memcpy(cs->carry + cs->n_carry, p, n);
+		cs->n_carry += n;
+		p += n;
+		if (cs->n_carry < need) return p;
+		if (has_header) break;
+	}
+	h->frame(ctx, &header, cs->carry + XFER_FRAME_HEADER_SIZE);
+	cs->n_carry = 0;
+	cs->carry_is_frame = 0;
+	return p;
+}
+
+static inline void com_scan_push(struct com_scan* cs, char* buf, size_t n, const struct com_scan_handlers* h, void* ctx)
+{
+	char* p = buf;
+	char* const end = buf + n;
+	while (p < end) {
+		if (cs->carry_is_frame) {
+			p = com_scan__frame(cs, p, end, h, ctx);
+			continue;
+		}
+
+		if (cs->n_carry == 0 && !cs->is_dropping_line) {
+			// at the start of a line
+			if (*p == '\r' || *p == '\n') {
+				p++;
+				continue;
+			}
+			if ((uint8_t)*p == XFER_FRAME_MAGIC) {
+				struct xfer_frame_header header;
+				if ((end - p) >= XFER_FRAME_HEADER_SIZE && xfer_frame_decode_header((uint8_t*)p, &header)) {
+					const unsigned size = XFER_FRAME_HEADER_SIZE + header.length;
+					if ((unsigned)(end - p) >= size) {
+						h->frame(ctx, &header, (uint8_t*)p + XFER_FRAME_HEADER_SIZE);
+						p += size;
+						continue;
+					}
+				}
+				cs->carry_is_frame = 1;
+				continue;
+			}
+		}
+
+		char* eol = com_scan__find_eol(p, end);
+		char* line_end = eol != NULL ? eol : end;
+		if (cs->is_dropping_line) {
+			// nothing
+		} else if ((cs->n_carry + (line_end - p)) >= COM_SCAN_MAX_LINE) {
+			// also lines entirely inside the buffer, so that handlers never
+			// see one longer than a carried line could be
+			cs->n_overlong_lines++;
+			cs->n_carry = 0;
+			cs->is_dropping_line = 1;
+		} else if (cs->n_carry == 0 && eol != NULL) {
+			*eol = 0;
+			h->line(ctx, p);
+		} else {
+			memcpy(cs->carry + cs->n_carry, p, line_end - p);
+			cs->n_carry += line_end - p;
+			if (eol != NULL) {
+				cs->carry[cs->n_carry] = 0;
+				cs->n_carry = 0;
+				h->line(ctx, (char*)cs->carry);
+			}
+		}
+		if (eol == NULL) return;
+		cs->is_dropping_line = 0;
+		p = eol + 1;
+	}
+}
+
+// skips spaces, then parses a decimal integer; returns 0 (and leaves *p
+// alone) if there isn't one
+static inline int com_parse_i64(char** p, int64_t* out)
+{
+	char* s = *p;
+	while (*s == ' ') s++;
+	int is_negative = 0;
+	if (*s == '-') {
+		is_negative = 1;
+		s++;
+	}
+	if (*s < '0' || *s > '9') return 0;
+	uint64_t v = 0;
+	while ('0' <= *s && *s <= '9') v = v*10 + (*s++ - '0');
+	*out = is_negative ? -(int64_t)v : (int64_t)v;
+	*p = s;
+	return 1;
+}
+
+static inline int com_parse_u32(char** p, uint32_t* out)
+{
+	char* s = *p;
+	int64_t v;
+	if (!com_parse_i64(&s, &v) || v < 0 || v > 0xffffffffll) return 0;
+	*out = v;
+	*p = s;
+	return 1;
+}
+
+static inline int com_parse_int(char** p, int* out)
+{
+	char* s = *p;
+	int64_t v;
+	if (!com_parse_i64(&s, &v) || v < -0x80000000ll || v > 0x7fffffffll) return 0;
+	*out = v;
+	*p = s;
+	return 1;
+}
+
+// skips spaces, then NUL-terminates the next space separated token in place;
+// returns NULL if there isn't one
+static inline char* com_parse_token(char** p)
+{
+	char* s = *p;
+	while (*s == ' ') s++;
+	if (*s == 0) return NULL;
+	char* token = s;
+	while (*s != ' ' && *s != 0) s++;
+	if (*s == ' ') *s++ = 0;
+	*p = s;
+	return token;
+}
+
+#define COM_SCAN_H
+#endif
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -41,6 +42,8 @@ void PANIC(uint32_t error) { fprintf(stderr, "PANIC(%d)\n", error); abort(); } /
 #include "base64.c" // eheheh
 #include "adler32.h"
 #include "adler32.c" // ;-)
+#include "xfer_frame.h"
+#include "com_scan.h"
 
 struct cond {
 	int value;
@@ -75,11 +78,119 @@ static void cond_signal(struct cond* cond)
 	cond_signal_value(cond, 1);
 }
 
+enum {
+	N_STATUS_BITS = 0
+	#define PIN(TYPE,NAME,GPN) + (TYPE==STATUS)
+	EMIT_PIN_CONFIG
+	#undef PIN
+};
+
 struct controller_status {
 	int64_t timestamp_us;
 	uint32_t status;
+	uint16_t n_edges[N_STATUS_BITS]; // per status bit, since the first status (wraps)
 };
 
+// Status history for the "Controller Status" scope: a ring of the latest
+// STATUS_STORE_SIZE statuses, with non-decreasing timestamps so they can be
+// binary searched, and for every level k the OR/AND of the statuses in each
+// aligned block of 1<<k of them. Any time span then draws in
+// O(pixels*log(statuses)), however long the session has been running.
+#define STATUS_STORE_SIZE_LOG2 (18)
+#define STATUS_STORE_SIZE (1 << STATUS_STORE_SIZE_LOG2)
+#define MAX_SCOPE_PIXELS (1 << 13)
+
+struct status_block {
+	uint32_t any; // OR
+	uint32_t all; // AND
+};
+
+struct status_store {
+	struct controller_status* ring;
+	struct status_block* levels[STATUS_STORE_SIZE_LOG2+1]; // level k has STATUS_STORE_SIZE>>k blocks; [0] is unused
+	int64_t n; // statuses ever added; index i is at ring[i & (STATUS_STORE_SIZE-1)]
+};
+
+static inline int64_t status_store_first(const struct status_store* ss)
+{
+	return ss->n > STATUS_STORE_SIZE ? ss->n - STATUS_STORE_SIZE : 0;
+}
+
+static inline const struct controller_status* status_store_get(const struct status_store* ss, int64_t i)
+{
+	assert(status_store_first(ss) <= i && i < ss->n);
+	return &ss->ring[i & (STATUS_STORE_SIZE-1)];
+}
+
+static void status_store_add(struct status_store* ss, int64_t timestamp_us, uint32_t status)
+{
+	if (ss->ring == NULL) {
+		ss->ring = (struct controller_status*)calloc(STATUS_STORE_SIZE, sizeof *ss->ring);
+		for (int k = 1; k <= STATUS_STORE_SIZE_LOG2; k++) {
+			ss->levels[k] = (struct status_block*)calloc(STATUS_STORE_SIZE >> k, sizeof *ss->levels[k]);
+		}
+	}
+
+	const int64_t i = ss->n;
+	struct controller_status* cs = &ss->ring[i & (STATUS_STORE_SIZE-1)];
+	const struct controller_status* prev = i > 0 ? status_store_get(ss, i-1) : NULL;
+	// timestamps from different lines may be slightly out of order
+	cs->timestamp_us = (prev != NULL && timestamp_us < prev->timestamp_us) ? prev->timestamp_us : timestamp_us;
+	cs->status = status;
+	const uint32_t prev_status = prev != NULL ? prev->status : 0;
+	for (int bit = 0; bit < N_STATUS_BITS; bit++) {
+		const uint16_t n_edges = prev != NULL ? prev->n_edges[bit] : 0;
+		cs->n_edges[bit] = n_edges + (((status ^ prev_status) >> bit) & 1);
+	}
+
+	for (int k = 1; k <= STATUS_STORE_SIZE_LOG2; k++) {
+		struct status_block* b = &ss->levels[k][(i >> k) & ((STATUS_STORE_SIZE >> k) - 1)];
+		if ((i & ((1 << k) - 1)) == 0) {
+			b->any = status;
+			b->all = status;
+		} else {
+			b->any |= status;
+			b->all &= status;
+		}
+	}
+	ss->n++;
+}
+
+// first index in [i0;n) with a timestamp >= t (n if none)
+static int64_t status_store_lower_bound(const struct status_store* ss, int64_t i0, int64_t t)
+{
+	int64_t lo = i0, hi = ss->n;
+	while (lo < hi) {
+		const int64_t mid = lo + (hi - lo) / 2;
+		if (status_store_get(ss, mid)->timestamp_us < t) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// OR/AND of the statuses in [i0;i1), from the largest aligned blocks
+static void status_store_combine(const struct status_store* ss, int64_t i0, int64_t i1, struct status_block* out)
+{
+	while (i0 < i1) {
+		int k = 0;
+		while (k < STATUS_STORE_SIZE_LOG2 && (i0 & ((2 << k) - 1)) == 0 && (i0 + (2 << k)) <= i1) k++;
+		uint32_t any, all;
+		if (k == 0) {
+			any = all = status_store_get(ss, i0)->status;
+		} else {
+			const struct status_block* b = &ss->levels[k][(i0 >> k) & ((STATUS_STORE_SIZE >> k) - 1)];
+			any = b->any;
+			all = b->all;
+		}
+		out->any |= any;
+		out->all &= all;
+		i0 += (1 << k);
+	}
+}
+
 struct com_file {
 	int in_use;
 	int fd;
@@ -88,21 +199,79 @@ struct com_file {
 	size_t bytes_total;
 	struct adler32 adler;
 	int n_non_zero_bytes;
+	int n_sectors; // >0 if CPPP_SECTOR_CRC was received
+	uint32_t address_ok_mask;
+	uint32_t data_ok_mask;
+	int n_retried_sectors; // sectors that needed more than one read (CPPP_SECTOR_ATTEMPTS)
+	int max_attempts;
+	int has_capture_telemetry; // CPPP_CAPTURE_TELEMETRY
+	unsigned n_captures;
+	uint32_t capture_fdebug;
+	unsigned n_words_missing;
+	unsigned n_pull_words_left;
+	unsigned capture_max_us;
+	int track_cylinder; // from the filename of track captures; -1 otherwise
+	int track_head;
+	int is_raw_stream; // CPPP_RAW_HEADER; INDEX markers go to index_fd
+	int index_fd;
+	int n_index_marks;
+};
+
+#define MAX_SYNC_ZONES (8)
+#define MAX_SYNC_BINS  (64)
+struct sync_histogram { // CPPP_SYNC_HISTOGRAM
+	int first_cylinder;
+	int origin;
+	int bin_width;
+	unsigned n_samples;
+	unsigned tuned_wait;
+	int n_bins;
+	float counts[MAX_SYNC_BINS];
+};
+
+#define MAX_SEEK_BANDS (16)
+struct seek_timing {
+	unsigned n, min_us, mean_us, max_us;
+};
+struct seek_profile_entry { // CPPP_SEEK_PROFILE
+	int first_distance;
+	int last_distance;
+	unsigned n_errors;
+	unsigned n_unseen_responses;
+	struct seek_timing response;
+	struct seek_timing seek;
 };
 
 #define MAX_FREQUNCIES (4)
+
+struct revolution_timing { // see CPPP_REVOLUTION
+	uint32_t n;
+	uint32_t mean_ns;
+	uint32_t min_ns;
+	uint32_t max_ns;
+	uint32_t stddev_ns;
+	uint32_t n_dropped;
+};
+
 struct com {
 	int fd;
 	char* tty_path;
-	char* recv_line_arr;
+	struct com_scan scan;
 	pthread_mutex_t queue_mutex;
 	char** queue_arr;
 
 	pthread_rwlock_t rwlock;
 	char** controller_log;
-	struct controller_status* controller_status_arr;
+	struct status_store status_store;
+	uint32_t n_status_events_lost; // see CPPP_STATUS_EVENTS
 	uint64_t controller_timestamp_us;
-	uint32_t frequencies[MAX_FREQUNCIES];
+	uint32_t frequencies[MAX_FREQUNCIES]; // mHz
+	struct revolution_timing revolution_timing;
+	struct sync_histogram sync_histograms[DRIVE_HEAD_COUNT][MAX_SYNC_ZONES][2];
+	struct seek_profile_entry seek_profile[MAX_SEEK_BANDS][2]; // [band][direction]
+	int* bad_tracks_arr; // <cylinder, head> pairs of downloaded tracks with CRC failures
+	int n_batch_checkpoints; // CPPP_BATCH_CHECKPOINT
+	int batch_checkpoint[3]; // cylinder, head, adjustment
 
 	struct com_file file;
 	int file_serial;
@@ -196,23 +365,16 @@ static void telemetry_log_status(void)
 }
 #endif
 
-static int starts_with(char* s, const char* prefix)
+// payload prefixes (CPPP_*) are two characters (except CPPP_LOG), so this is
+// a few compares; `s` is at least "\0"-terminated so s[2] is only read when
+// s[0] and s[1] aren't NUL
+static inline int is_payload(char* s, const char* cppp, char** tail)
 {
-	const int prefix_length = strlen(prefix);
-	if (prefix_length > strlen(s)) return 0;
-	for (int i = 0; i < prefix_length; i++) {
-		if (s[i] != prefix[i]) return 0;
-	}
+	if (s[0] != cppp[0] || s[1] != cppp[1] || (s[2] != ' ' && s[2] != 0)) return 0;
+	*tail = s + 2;
 	return 1;
 }
 
-static int is_payload(char* s, const char* cppp, char** tail)
-{
-	size_t ncppp = strlen(cppp);
-	if (tail) *tail = s + ncppp;
-	return starts_with(s, cppp) && (s[ncppp] == ' ' || s[ncppp] == 0);
-}
-
 static char* duplicate_string(char* s) // strdup() is deprecated?
 {
 	const size_t sz = strlen(s)+1;
@@ -226,9 +388,30 @@ static void end_com_file(void)
 	struct com_file* cf = &com.file;
 	if (!cf->in_use) return;
 	close(cf->fd);
+	if (cf->is_raw_stream) close(cf->index_fd);
 	memset(cf, 0, sizeof *cf);
 }
 
+// creates `filename`, or a "-resolv" variant if it already exists; the path
+// actually used is written to `path`
+static int open_new_file(const char* filename, char* path, size_t path_size)
+{
+	snprintf(path, path_size, "%s", filename);
+	for (;;) {
+		int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (fd == -1) {
+			if (errno == EEXIST) {
+				snprintf(path, path_size, "%s-resolv%d", filename, rand());
+				continue;
+			} else {
+				fprintf(stderr, "%s: %s\n", path, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+		return fd;
+	}
+}
+
 __attribute__((format(printf, 1, 2)))
 static void com_printf(const char* fmt, ...)
 {
@@ -247,11 +430,66 @@ static void bad_msg(char* msg)
 	com_printf("WARNING: garbage message from controller: [%s]", msg);
 }
 
+// caller holds com.rwlock for writing
+static void add_controller_status(int64_t timestamp_us, uint32_t status)
+{
+	status_store_add(&com.status_store, timestamp_us, status);
+	if (timestamp_us > com.controller_timestamp_us) {
+		com.controller_timestamp_us = timestamp_us;
+	}
+	if (com.log_status_changes) {
+		com_printf("STAT t=%lu st=%d", timestamp_us, status);
+	}
+}
+
+static void com_file_write(struct com_file* comfile, const uint8_t* data, size_t n)
+{
+	adler32_push(&comfile->adler, data, n);
+	for (size_t i = 0; i < n; i++) if (data[i] != 0) comfile->n_non_zero_bytes++;
+	comfile->bytes_written += n;
+	size_t remaining = n;
+	const uint8_t* tp = data;
+	while (remaining > 0) {
+		ssize_t nw = write(comfile->fd, tp, remaining);
+		if (nw == -1) {
+			if (errno == EINTR) {
+				continue;
+			} else {
+				assert(!"write error");
+			}
+		}
+		tp += nw;
+		remaining -= nw;
+	}
+}
+
+static void com__handle_frame(const struct xfer_frame_header* header, const uint8_t* payload)
+{
+	struct com_file* comfile = &com.file;
+	if (!comfile->in_use) {
+		com_printf("ERROR: out of sequence (not-in-use) data frame (sequence %d)", header->sequence);
+		return;
+	}
+	if (header->sequence != (comfile->sequence & 0xffff)) {
+		com_printf("ERROR: out of sequence (expected %d, got %d) data frame", comfile->sequence & 0xffff, header->sequence);
+		end_com_file();
+		return;
+	}
+	comfile->sequence++;
+	const uint32_t checksum = adler32(payload, header->length);
+	if (checksum != header->checksum) {
+		com_printf("ERROR: bad frame checksum (sequence %d); pico says %u; our calc says %u", header->sequence, header->checksum, checksum);
+		end_com_file();
+		return;
+	}
+	com_file_write(comfile, payload, header->length);
+}
+
 static void com__handle_msg(char* msg)
 {
 	struct com_file* comfile = &com.file;
 	char* tail = NULL;
-	if (starts_with(msg, CPPP_LOG)) {
+	if (msg[0] == CPPP_LOG[0]) {
 		printf("(CTRL) %s\n", msg);
 		msg = duplicate_string(msg);
 		pthread_rwlock_wrlock(&com.rwlock);
@@ -259,37 +497,62 @@ static void com__handle_msg(char* msg)
 		pthread_rwlock_unlock(&com.rwlock);
 	} else if (is_payload(msg, CPPP_FREQ, &tail)) {
 		uint32_t num = 0, value = 0;
-		if (sscanf(tail, " %u %u", &num, &value) == 2) {
+		if (com_parse_u32(&tail, &num) && com_parse_u32(&tail, &value)) {
 			if (0 <= num && num < MAX_FREQUNCIES) {
-				com.frequencies[num] = value * FREQ_FREQ_HZ;
+				com.frequencies[num] = value;
 			} else {
 				bad_msg(msg);
 			}
 		} else {
 			bad_msg(msg);
 		}
+	} else if (is_payload(msg, CPPP_REVOLUTION, &tail)) {
+		struct revolution_timing t = {0};
+		if (com_parse_u32(&tail, &t.n)
+				&& com_parse_u32(&tail, &t.mean_ns)
+				&& com_parse_u32(&tail, &t.min_ns)
+				&& com_parse_u32(&tail, &t.max_ns)
+				&& com_parse_u32(&tail, &t.stddev_ns)
+				&& com_parse_u32(&tail, &t.n_dropped)) {
+			com.revolution_timing = t;
+		} else {
+			bad_msg(msg);
+		}
 	} else if (is_payload(msg, CPPP_STATUS, &tail)) {
 		int64_t timestamp_us = 0;
 		uint32_t status = 0;
-		if (sscanf(tail, " %ld %u", &timestamp_us, &status) == 2) {
-			struct controller_status s;
-			s.timestamp_us = timestamp_us;
-			s.status = status;
+		if (com_parse_i64(&tail, &timestamp_us) && com_parse_u32(&tail, &status)) {
 			pthread_rwlock_wrlock(&com.rwlock);
-			arrput(com.controller_status_arr, s);
-			if (timestamp_us > com.controller_timestamp_us) {
-				com.controller_timestamp_us = timestamp_us;
-			}
-			if (com.log_status_changes) {
-				com_printf("STAT t=%lu st=%d", s.timestamp_us, s.status);
-			}
+			add_controller_status(timestamp_us, status);
 			pthread_rwlock_unlock(&com.rwlock);
 		} else {
 			bad_msg(msg);
 		}
+	} else if (is_payload(msg, CPPP_STATUS_EVENTS, &tail)) {
+		uint32_t n_lost = 0;
+		if (!com_parse_u32(&tail, &n_lost)) {
+			bad_msg(msg);
+		} else {
+			pthread_rwlock_wrlock(&com.rwlock);
+			com.n_status_events_lost += n_lost;
+			int64_t timestamp_us = 0;
+			for (int i = 0; ; i++) {
+				int64_t t = 0;
+				uint32_t status = 0;
+				if (!com_parse_i64(&tail, &t)) break;
+				if (!com_parse_u32(&tail, &status)) {
+					bad_msg(msg);
+					break;
+				}
+				// first is absolute, then relative to the previous
+				timestamp_us = (i == 0) ? t : (timestamp_us + t);
+				add_controller_status(timestamp_us, status);
+			}
+			pthread_rwlock_unlock(&com.rwlock);
+		}
 	} else if (is_payload(msg, CPPP_TIME, &tail)) {
 		int64_t timestamp_us;
-		if (sscanf(tail, " %ld", &timestamp_us) == 1) {
+		if (com_parse_i64(&tail, &timestamp_us)) {
 			pthread_rwlock_wrlock(&com.rwlock);
 			if (timestamp_us > com.controller_timestamp_us) com.controller_timestamp_us = timestamp_us;
 			pthread_rwlock_unlock(&com.rwlock);
@@ -301,32 +564,195 @@ static void com__handle_msg(char* msg)
 		char filename[1<<10];
 		if (sscanf(tail, " %d %s", &n_bytes, filename) == 2) {
 			assert(!comfile->in_use);
-			char other_filename[1<<11];
-			char* path = filename;
-			for (;;) {
-				int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
-				if (fd == -1) {
-					if (errno == EEXIST) {
-						snprintf(
-							other_filename, sizeof other_filename,
-							"%s-resolv%d", filename, rand());
-						path = other_filename;
-						continue;
-					} else {
-						fprintf(stderr, "%s: %s\n", path, strerror(errno));
-						exit(EXIT_FAILURE);
-					}
-				}
-				memset(comfile, 0, sizeof *comfile);
-				comfile->in_use = 1;
-				comfile->fd = fd;
-				comfile->bytes_total = n_bytes;
-				adler32_init(&comfile->adler);
-				com_printf("D/L %d bytes [%s]...", n_bytes, path);
-				telemetry_log("beginning to download %d bytes...", n_bytes);
-				comfile->n_non_zero_bytes = 0;
-				break;
+			char path[1<<11];
+			const int fd = open_new_file(filename, path, sizeof path);
+			memset(comfile, 0, sizeof *comfile);
+			comfile->in_use = 1;
+			comfile->fd = fd;
+			comfile->bytes_total = n_bytes;
+			if (sscanf(filename, "cylinder%d-head%d", &comfile->track_cylinder, &comfile->track_head) != 2) {
+				comfile->track_cylinder = comfile->track_head = -1;
+			}
+			adler32_init(&comfile->adler);
+			com_printf("D/L %d bytes [%s]...", n_bytes, path);
+			telemetry_log("beginning to download %d bytes...", n_bytes);
+			comfile->n_non_zero_bytes = 0;
+		} else {
+			bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_RAW_HEADER, &tail)) {
+		char filename[1<<10];
+		if (sscanf(tail, " %s", filename) == 1) {
+			assert(!comfile->in_use);
+			char path[1<<11];
+			const int fd = open_new_file(filename, path, sizeof path);
+			char index_filename[(1<<11)+10];
+			snprintf(index_filename, sizeof index_filename, "%s.index", path);
+			char index_path[sizeof index_filename + 100];
+			const int index_fd = open_new_file(index_filename, index_path, sizeof index_path);
+			memset(comfile, 0, sizeof *comfile);
+			comfile->in_use = 1;
+			comfile->is_raw_stream = 1;
+			comfile->fd = fd;
+			comfile->index_fd = index_fd;
+			adler32_init(&comfile->adler);
+			com_printf("Raw stream [%s] (INDEX byte offsets in [%s])...", path, index_path);
+			telemetry_log("beginning raw stream...");
+		} else {
+			bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_RAW_INDEX, &tail)) {
+		unsigned byte_offset = 0;
+		if (!comfile->in_use || !comfile->is_raw_stream) {
+			com_printf("WARNING: out of sequence (not-in-use) index marker [%s]", msg);
+		} else if (com_parse_u32(&tail, &byte_offset)) {
+			dprintf(comfile->index_fd, "%u\n", byte_offset);
+			comfile->n_index_marks++;
+		} else {
+			bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_RAW_FOOTER, &tail)) {
+		int sequence = -1;
+		uint32_t pico_checksum = 0;
+		size_t n_bytes = 0;
+		int has_overflowed = 0;
+		if (!comfile->in_use || !comfile->is_raw_stream) {
+			com_printf("WARNING: out of sequence (not-in-use) raw footer [%s]", msg);
+		} else if (sscanf(tail, " %d %u %zu %d", &sequence, &pico_checksum, &n_bytes, &has_overflowed) == 4) {
+			const uint32_t our_checksum = adler32_sum(&comfile->adler);
+			if (sequence != comfile->sequence || n_bytes != comfile->bytes_written) {
+				com_printf("ERROR: raw stream lost frames (pico sent %zd bytes; received %zd)", n_bytes, comfile->bytes_written);
+			} else if (our_checksum != pico_checksum) {
+				com_printf("ERROR: bad raw stream checksum; pico says %u; our calc says %u", pico_checksum, our_checksum);
+			} else if (has_overflowed) {
+				com_printf("WARNING: raw stream overflowed after %zd bytes (%d INDEX markers); USB didn't keep up", n_bytes, comfile->n_index_marks);
+				telemetry_log("raw stream overflowed");
+			} else {
+				com_printf("Raw stream done: %zd bytes, %d INDEX markers", n_bytes, comfile->n_index_marks);
+				telemetry_log("raw stream done");
 			}
+			end_com_file();
+			com.file_serial++;
+		} else {
+			bad_msg(msg);
+			end_com_file();
+		}
+	} else if (is_payload(msg, CPPP_SECTOR_CRC, &tail)) {
+		int n_sectors = 0;
+		uint32_t address_ok_mask = 0, data_ok_mask = 0;
+		if (!comfile->in_use) {
+			com_printf("WARNING: out of sequence (not-in-use) sector CRC line [%s]", msg);
+		} else if (sscanf(tail, " %d %u %u", &n_sectors, &address_ok_mask, &data_ok_mask) == 3 && 0 < n_sectors && n_sectors <= 32) {
+			comfile->n_sectors = n_sectors;
+			comfile->address_ok_mask = address_ok_mask;
+			comfile->data_ok_mask = data_ok_mask;
+		} else {
+			bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_SECTOR_ATTEMPTS, &tail)) {
+		if (!comfile->in_use) {
+			com_printf("WARNING: out of sequence (not-in-use) sector attempts line [%s]", msg);
+		} else {
+			char* p = tail;
+			char* endp = NULL;
+			const long n_sectors = strtol(p, &endp, 10);
+			int i = 0;
+			for (p = endp; i < n_sectors; i++, p = endp) {
+				const long attempts = strtol(p, &endp, 10);
+				if (endp == p) break;
+				if (attempts > 1) comfile->n_retried_sectors++;
+				if (attempts > comfile->max_attempts) comfile->max_attempts = attempts;
+			}
+			if (n_sectors <= 0 || i != n_sectors) bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_SYNC_HISTOGRAM, &tail)) {
+		struct sync_histogram h = {0};
+		unsigned head = 0, zone = 0, field = 0;
+		int n = 0;
+		if (sscanf(tail, " %u %u %d %u %d %d %u %u%n",
+				&head,
+				&zone,
+				&h.first_cylinder,
+				&field,
+				&h.origin,
+				&h.bin_width,
+				&h.n_samples,
+				&h.tuned_wait,
+				&n) == 8 && head < DRIVE_HEAD_COUNT && zone < MAX_SYNC_ZONES && field < 2) {
+			char* p = tail + n;
+			char* endp = NULL;
+			for (; h.n_bins < MAX_SYNC_BINS; h.n_bins++, p = endp) {
+				const long count = strtol(p, &endp, 10);
+				if (endp == p) break;
+				h.counts[h.n_bins] = count;
+			}
+			pthread_rwlock_wrlock(&com.rwlock);
+			com.sync_histograms[head][zone][field] = h;
+			pthread_rwlock_unlock(&com.rwlock);
+		} else {
+			bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_SEEK_PROFILE, &tail)) {
+		struct seek_profile_entry e = {0};
+		unsigned direction = 0;
+		if (sscanf(tail, " %d %d %u %u %u %u %u %u %u %u %u %u %u",
+				&e.first_distance,
+				&e.last_distance,
+				&direction,
+				&e.n_errors,
+				&e.n_unseen_responses,
+				&e.response.n, &e.response.min_us, &e.response.mean_us, &e.response.max_us,
+				&e.seek.n, &e.seek.min_us, &e.seek.mean_us, &e.seek.max_us) == 13
+				&& e.first_distance > 0 && direction < 2) {
+			const int band = 31 - __builtin_clz(e.first_distance);
+			if (band < MAX_SEEK_BANDS) {
+				pthread_rwlock_wrlock(&com.rwlock);
+				com.seek_profile[band][direction] = e;
+				pthread_rwlock_unlock(&com.rwlock);
+			}
+		} else {
+			bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_BATCH_CHECKPOINT, &tail)) {
+		int checkpoint[3];
+		if (sscanf(tail, " %d %d %d", &checkpoint[0], &checkpoint[1], &checkpoint[2]) == 3) {
+			pthread_rwlock_wrlock(&com.rwlock);
+			memcpy(com.batch_checkpoint, checkpoint, sizeof checkpoint);
+			com.n_batch_checkpoints++;
+			pthread_rwlock_unlock(&com.rwlock);
+		} else {
+			bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_SCRIPT_STEP, &tail)) {
+		unsigned step = 0, op = 0, status = 0, result = 0;
+		uint64_t duration_us = 0;
+		if (sscanf(tail, " %u %u %u %" SCNu64 " %u", &step, &op, &status, &duration_us, &result) == 5) {
+			const char* name = "?";
+			#define SCRIPT_OP(NAME,VALUE,DESC) if (op == VALUE) name = #NAME;
+			EMIT_SCRIPT_OPS
+			#undef SCRIPT_OP
+			if (status != XST_DONE) {
+				com_printf("ERROR: script failed at step %u (error %u)", step, status);
+			} else if (op == SCRIPT_OP_READ_TRACK || op == SCRIPT_OP_QUEUE_TRACK) {
+				com_printf("script step %u: %s, %u sectors OK (%.1fms)", step, name, result, (double)duration_us * 1e-3);
+			} else {
+				com_printf("script step %u: %s (%.1fms)", step, name, (double)duration_us * 1e-3);
+			}
+		} else {
+			bad_msg(msg);
+		}
+	} else if (is_payload(msg, CPPP_CAPTURE_TELEMETRY, &tail)) {
+		unsigned total_us = 0;
+		if (!comfile->in_use) {
+			com_printf("WARNING: out of sequence (not-in-use) capture telemetry line [%s]", msg);
+		} else if (sscanf(tail, " %u %u %u %u %u %u",
+				&comfile->n_captures,
+				&comfile->capture_fdebug,
+				&comfile->n_words_missing,
+				&comfile->n_pull_words_left,
+				&total_us,
+				&comfile->capture_max_us) == 6) {
+			comfile->has_capture_telemetry = 1;
 		} else {
 			bad_msg(msg);
 		}
@@ -335,8 +761,8 @@ static void com__handle_msg(char* msg)
 			com_printf("ERROR: out of sequence (not-in-use) data line [%s]", msg);
 		} else {
 			int sequence = -1;
-			char b64[1<<10];
-			if (sscanf(tail, " %d %s", &sequence, b64) == 2) {
+			char* b64 = NULL;
+			if (com_parse_int(&tail, &sequence) && (b64 = com_parse_token(&tail)) != NULL) {
 				if (sequence != comfile->sequence) {
 					com_printf("ERROR: out of sequence (expected %d, got %d) data line [%s]", comfile->sequence, sequence, msg);
 					end_com_file();
@@ -344,30 +770,20 @@ static void com__handle_msg(char* msg)
 				} else {
 					comfile->sequence++;
 					uint8_t buffer[1<<10];
+					// every 4 base64 chars decode to at most 3 bytes
+					const size_t n_b64 = strlen(b64);
+					if (n_b64 > 4*sizeof buffer/3) {
+						com_printf("ERROR: data line too long (%zu base64 chars)", n_b64);
+						end_com_file();
+						return;
+					}
 					uint8_t* eb = base64_decode_line(buffer, b64);
 					if (eb == NULL) {
 						com_printf("ERROR: could not decode data line [%s]", msg);
 						end_com_file();
 						return;
 					} else {
-						const size_t n_recv = eb - buffer;
-						adler32_push(&comfile->adler, buffer, n_recv);
-						for (size_t i = 0; i < n_recv; i++) if (buffer[i] != 0) comfile->n_non_zero_bytes++;
-						comfile->bytes_written += n_recv;
-						size_t remaining = n_recv;
-						uint8_t* tp = buffer;
-						while (remaining > 0) {
-							ssize_t nw = write(comfile->fd, tp, remaining);
-							if (nw == -1) {
-								if (errno == EINTR) {
-									continue;
-								} else {
-									assert(!"write error");
-								}
-							}
-							tp += nw;
-							remaining -= nw;
-						}
+						com_file_write(comfile, buffer, eb - buffer);
 					}
 				}
 			} else {
@@ -381,7 +797,7 @@ static void com__handle_msg(char* msg)
 		} else {
 			int sequence = -1;
 			uint32_t pico_checksum = 0;
-			if (sscanf(tail, " %d %u", &sequence, &pico_checksum) == 2) {
+			if (com_parse_int(&tail, &sequence) && com_parse_u32(&tail, &pico_checksum)) {
 				const uint32_t our_checksum = adler32_sum(&comfile->adler);
 				if (comfile->bytes_written != comfile->bytes_total) {
 					com_printf("ERROR: expected %zd bytes; only received %zd", comfile->bytes_total, comfile->bytes_written);
@@ -399,6 +815,38 @@ static void com__handle_msg(char* msg)
 					return;
 				}
 				close(comfile->fd);
+				if (comfile->n_sectors > 0) {
+					const uint32_t all = comfile->n_sectors == 32 ? 0xffffffff : ((1u << comfile->n_sectors) - 1);
+					const uint32_t bad = ~(comfile->address_ok_mask & comfile->data_ok_mask) & all;
+					if (bad != 0) {
+						com_printf("WARNING: %d/%d sectors failed CRC (address ok: 0x%.8x, data ok: 0x%.8x)",
+							__builtin_popcount(bad), comfile->n_sectors,
+							comfile->address_ok_mask, comfile->data_ok_mask);
+						telemetry_log("sector CRC failures: address ok 0x%.8x, data ok 0x%.8x", comfile->address_ok_mask, comfile->data_ok_mask);
+						if (comfile->track_cylinder >= 0) {
+							pthread_rwlock_wrlock(&com.rwlock);
+							arrput(com.bad_tracks_arr, comfile->track_cylinder);
+							arrput(com.bad_tracks_arr, comfile->track_head);
+							pthread_rwlock_unlock(&com.rwlock);
+						}
+					}
+				}
+				if (comfile->n_retried_sectors > 0) {
+					com_printf("%d sectors needed re-reads (up to %d reads)", comfile->n_retried_sectors, comfile->max_attempts);
+				}
+				if (comfile->has_capture_telemetry) {
+					const uint32_t fdebug = comfile->capture_fdebug;
+					if ((fdebug & (CAPTURE_FDEBUG_RXSTALL | CAPTURE_FDEBUG_TXSTALL)) || comfile->n_words_missing > 0) {
+						com_printf("WARNING: capture path trouble in %u captures:%s%s (%u words missing, %u pull words left, max %uus)",
+							comfile->n_captures,
+							(fdebug & CAPTURE_FDEBUG_RXSTALL) ? " RX FIFO stalled (bits lost)" : "",
+							(fdebug & CAPTURE_FDEBUG_TXSTALL) ? " pull words ran dry" : "",
+							comfile->n_words_missing,
+							comfile->n_pull_words_left,
+							comfile->capture_max_us);
+						telemetry_log("capture path trouble: fdebug 0x%.8x, %u words missing", fdebug, comfile->n_words_missing);
+					}
+				}
 				if (comfile->n_non_zero_bytes == 0) {
 					com_printf("WARNING: downloaded file contains only zeroes");
 					telemetry_log("download done (all zeroes!)");
@@ -417,17 +865,164 @@ static void com__handle_msg(char* msg)
 	}
 }
 
-static void com_recv_char(char ch)
+static void com__handle_line(void* ctx, char* line)
+{
+	com__handle_msg(line);
+}
+
+static void com__handle_frame_cb(void* ctx, const struct xfer_frame_header* header, const uint8_t* payload)
+{
+	com__handle_frame(header, payload);
+}
+
+static void com__handle_bad_frame(void* ctx, const struct xfer_frame_header* header)
+{
+	com_printf("ERROR: bad frame header (length %d)", header->length);
+	end_com_file();
+}
+
+static const struct com_scan_handlers com_scan_handlers = {
+	com__handle_line,
+	com__handle_frame_cb,
+	com__handle_bad_frame,
+};
+
+static void com_recv(char* buf, size_t n)
+{
+	struct com_scan* cs = &com.scan;
+	const unsigned n_overlong_lines = cs->n_overlong_lines;
+	com_scan_push(cs, buf, n, &com_scan_handlers, NULL);
+	if (cs->n_overlong_lines != n_overlong_lines) {
+		com_printf("WARNING: dropped line longer than %d bytes", COM_SCAN_MAX_LINE);
+	}
+}
+
+__attribute__((format(printf, 1, 2)))
+static void com_enqueue(const char* fmt, ...);
+
+static void put_script_step(uint8_t** steps_arr, enum script_op op, int a, int b)
+{
+	arrput(*steps_arr, op);
+	arrput(*steps_arr, a & 0xff);
+	arrput(*steps_arr, b & 0xff);
+	arrput(*steps_arr, (b >> 8) & 0xff);
+}
+
+// the last op_read_batch sent, for op_resume_batch
+static struct {
+	int is_set;
+	int cylinder0, cylinder1, head_set, n_32bit_words, servo_offset, data_strobe_delay, max_retries, flags;
+	int n_checkpoints0; // com.n_batch_checkpoints when it was sent
+} last_batch;
+
+static void enqueue_batch_read(int cylinder0, int cylinder1, int head_set, int n_32bit_words, int servo_offset, int data_strobe_delay, int max_retries, int flags)
+{
+	last_batch.is_set = 1;
+	last_batch.cylinder0 = cylinder0;
+	last_batch.cylinder1 = cylinder1;
+	last_batch.head_set = head_set;
+	last_batch.n_32bit_words = n_32bit_words;
+	last_batch.servo_offset = servo_offset;
+	last_batch.data_strobe_delay = data_strobe_delay;
+	last_batch.max_retries = max_retries;
+	last_batch.flags = flags;
+	last_batch.n_checkpoints0 = com.n_batch_checkpoints;
+	com_enqueue("%s %d %d %d %d %d %d %d %d",
+		CMDSTR_op_read_batch,
+		cylinder0, cylinder1, head_set, n_32bit_words,
+		servo_offset, data_strobe_delay, max_retries, flags);
+}
+
+// continues the last batch after its last checkpoint; returns 0 if there's
+// nothing to resume from
+static int enqueue_batch_resume(void)
+{
+	if (!last_batch.is_set || com.n_batch_checkpoints == last_batch.n_checkpoints0) return 0;
+	com_enqueue("%s %d %d %d %d %d %d %d %d %d %d",
+		CMDSTR_op_resume_batch,
+		com.batch_checkpoint[0],
+		last_batch.cylinder1,
+		last_batch.head_set,
+		last_batch.n_32bit_words,
+		last_batch.servo_offset,
+		last_batch.data_strobe_delay,
+		last_batch.max_retries,
+		last_batch.flags,
+		com.batch_checkpoint[1],
+		com.batch_checkpoint[2]);
+	return 1;
+}
+
+#define TRACK_LIST_STRIDE (4) // cylinder, head, servo offset, data strobe delay
+
+// uploads and runs a job script that reads `tracks` (TRACK_LIST_STRIDE ints
+// each). in request order, it seeks whenever the cylinder changes; otherwise
+// the tracks are queued and the controller picks the order (elevator)
+static void enqueue_track_list_script(const int* tracks, int n_tracks, int max_retries, int flags, bool is_elevator, enum seek_mode seek_mode)
+{
+	uint8_t* steps_arr = NULL;
+	put_script_step(&steps_arr, SCRIPT_OP_SET_RETRIES, 0, max_retries);
+	put_script_step(&steps_arr, SCRIPT_OP_SET_FLAGS, 0, flags);
+	put_script_step(&steps_arr, SCRIPT_OP_SET_SEEK_MODE, 0, seek_mode);
+	int cylinder = -1;
+	int servo_offset = -2, data_strobe_delay = -2;
+	for (const int* t = tracks; t < tracks + n_tracks*TRACK_LIST_STRIDE; t += TRACK_LIST_STRIDE) {
+		if (is_elevator) {
+			put_script_step(&steps_arr, SCRIPT_OP_QUEUE_TRACK, SCRIPT_TRACK_A(t[1], t[2], t[3]), t[0]);
+			continue;
+		}
+		if (t[2] != servo_offset || t[3] != data_strobe_delay) {
+			servo_offset = t[2];
+			data_strobe_delay = t[3];
+			put_script_step(&steps_arr, SCRIPT_OP_SET_ADJUSTMENT, servo_offset, data_strobe_delay);
+		}
+		if (t[0] != cylinder) {
+			cylinder = t[0];
+			put_script_step(&steps_arr, SCRIPT_OP_SEEK, 0, cylinder);
+		}
+		put_script_step(&steps_arr, SCRIPT_OP_READ_TRACK, t[1], 0);
+	}
+	if (is_elevator) put_script_step(&steps_arr, SCRIPT_OP_SERVE_QUEUE, 0, 0);
+
+	// a script_append line must fit in the controller's 1KiB token buffer
+	const int bytes_per_line = 128*SCRIPT_STEP_SIZE;
+	com_enqueue("%s", CMDSTR_script_clear);
+	for (int offset = 0; offset < arrlen(steps_arr); offset += bytes_per_line) {
+		const int n = arrlen(steps_arr) - offset;
+		char b64[((bytes_per_line+2)/3)*4 + 1];
+		*base64_encode(b64, steps_arr + offset, n < bytes_per_line ? n : bytes_per_line) = 0;
+		com_enqueue("%s %s", CMDSTR_script_append, b64);
+	}
+	com_enqueue("%s", CMDSTR_op_run_script);
+	arrfree(steps_arr);
+}
+
+// parses "<cylinder> <head> [<servo offset> <data strobe delay>]" lines into
+// `tracks_arr`; returns the number of tracks, or -1 if a line is bad
+static int parse_track_list(const char* text, int** tracks_arr, int servo_offset, int data_strobe_delay)
 {
-	if (ch == '\r' || ch == '\n') {
-		if (arrlen(com.recv_line_arr) > 0) {
-			arrput(com.recv_line_arr, 0);
-			com__handle_msg(com.recv_line_arr);
-			arrsetlen(com.recv_line_arr, 0);
+	arrsetlen(*tracks_arr, 0);
+	int n_bad = 0;
+	for (const char* line = text; *line; ) {
+		const char* eol = strchr(line, '\n');
+		int t[TRACK_LIST_STRIDE] = { -1, -1, servo_offset, data_strobe_delay };
+		const int n = sscanf(line, "%d %d %d %d", &t[0], &t[1], &t[2], &t[3]);
+		if (n == 2 || n == 4) {
+			if (   t[0] < 0 || t[0] >= DRIVE_CYLINDER_COUNT
+			    || t[1] < 0 || t[1] >= DRIVE_HEAD_COUNT
+			    || t[2] < -1 || t[2] > 1
+			    || t[3] < -1 || t[3] > 1) {
+				n_bad++;
+			} else {
+				for (int i = 0; i < TRACK_LIST_STRIDE; i++) arrput(*tracks_arr, t[i]);
+			}
+		} else if (n > 0) {
+			n_bad++;
 		}
-	} else {
-		arrput(com.recv_line_arr, ch);
+		if (eol == NULL) break;
+		line = eol+1;
 	}
+	return n_bad > 0 ? -1 : arrlen(*tracks_arr) / TRACK_LIST_STRIDE;
 }
 
 __attribute__((format(printf, 1, 2)))
@@ -473,6 +1068,7 @@ void* io_thread_start(void* arg)
 	struct timeval timeout = {0};
 
 	com_enqueue("%s 1", CMDSTR_subscribe_to_status);
+	com_enqueue("%s %d", CMDSTR_set_transfer_mode, TRANSFER_MODE_BINARY);
 
 	for (;;) {
 		fd_set rfds, wfds;
@@ -505,7 +1101,7 @@ void* io_thread_start(void* arg)
 				fprintf(stderr, "tty: %s\n", strerror(errno));
 				exit(EXIT_FAILURE);
 			}
-			for (int i = 0; i < n; i++) com_recv_char(buf[i]);
+			com_recv(buf, n);
 		}
 
 		if (FD_ISSET(com.fd, &wfds)) {
@@ -600,11 +1196,15 @@ static ImU32 get_status_label_color(const char* label, int st)
 		b = 1.0;
 	}
 
+	// st=2 is "on some of the time" (scope columns that cover several
+	// statuses), drawn halfway between off and on
 	double m = 1.0;
 	if (st == 0) {
 		m = 0.2;
 	} else if (st == 1) {
 		m = 1.0;
+	} else if (st == 2) {
+		m = 0.5;
 	} else {
 		assert(!"UNREACHABLE");
 	}
@@ -691,6 +1291,12 @@ int main(int argc, char** argv)
 	int batch_cylinder0 = 0;
 	int batch_cylinder1 = 822;
 	int batch_head_set = 31;
+	int batch_max_retries = 0;
+	int batch_flags = 0;
+	// COMMAND set_sector_layout arguments (struct cr8044read_layout)
+	const int cr8044_sector_layout[] = { 32, 32, 9, 32, 551, 1, 0x9D, 4 };
+	int sector_layout[8];
+	memcpy(sector_layout, cr8044_sector_layout, sizeof sector_layout);
 	int common_32bit_word_count = MAX_DATA_BUFFER_SIZE/4;
 	int common_servo_offset = 0;
 	int common_data_strobe_delay = 0;
@@ -698,6 +1304,7 @@ int main(int argc, char** argv)
 	uint32_t last_poll_gpio = 0;
 	int broken_seek_cylinder = 0;
 	bool continuous_read = false;
+	int raw_read_revolutions = 5;
 	int continuous_read_serial = 0;
 
 	int max_status_txt_width = 0;
@@ -789,54 +1396,107 @@ int main(int argc, char** argv)
 			debug_control_pins = (debug_control_pins & ((1<<bits_shift)-1)) | (tmp_bits << bits_shift);
 
 			ImGui::SeparatorText("Ops");
-			if (ImGui::Button("Read data (no checks)")) {
-				com_enqueue("%s %d %d %d", CMDSTR_op_read_data, MAX_DATA_BUFFER_SIZE/4, /*index_sync=*/1, /*skip_checks=*/0);
+			ImGui::SetNextItemWidth(100);
+			ImGui::InputInt("Revolutions##rawrevs", &raw_read_revolutions);
+			if (raw_read_revolutions < 1) raw_read_revolutions = 1;
+			const int raw_read_n_32bit_words = raw_read_revolutions * (DRIVE_BYTES_PER_TRACK/4);
+			ImGui::SameLine();
+			if (ImGui::Button("Raw read")) {
+				com_enqueue("%s %d %d %d", CMDSTR_op_read_data, raw_read_n_32bit_words, /*index_sync=*/1, /*skip_checks=*/0);
 			}
+			ImGui::SetItemTooltip("Streams raw READ_DATA to a .nrz file (INDEX byte offsets in .nrz.index); needs USB to keep up");
 			ImGui::SameLine();
 			if (ImGui::Checkbox("Continuous", &continuous_read) && continuous_read) {
-				com_enqueue("%s %d %d %d", CMDSTR_op_read_data, MAX_DATA_BUFFER_SIZE/4, /*index_sync=*/1, /*skip_checks=*/0);
+				com_enqueue("%s %d %d %d", CMDSTR_op_read_data, raw_read_n_32bit_words, /*index_sync=*/1, /*skip_checks=*/0);
 			}
 			if (continuous_read && com.file_serial > continuous_read_serial) {
-				com_enqueue("%s %d %d %d", CMDSTR_op_read_data, MAX_DATA_BUFFER_SIZE/4, /*index_sync=*/1, /*skip_checks=*/0);
+				com_enqueue("%s %d %d %d", CMDSTR_op_read_data, raw_read_n_32bit_words, /*index_sync=*/1, /*skip_checks=*/0);
 				continuous_read_serial = com.file_serial;
 			}
 
 			ImGui::InputInt("Ncyl##ncyl", &n_cyls);
+			ImGui::InputInt("Retries##retries", &batch_max_retries);
+			if (batch_max_retries < 0) batch_max_retries = 0;
+			ImGui::SetItemTooltip("Extra revolutions per track for re-reading sectors that failed CRC");
+			ImGui::CheckboxFlags("Pipelined##pipelined", &batch_flags, BATCH_FLAG_PIPELINED);
+			ImGui::SetItemTooltip("Switch heads between back-to-back revolutions (0adj only)");
+			ImGui::SameLine();
+			ImGui::CheckboxFlags("Any sector##anysector", &batch_flags, BATCH_FLAG_ANY_SECTOR);
+			ImGui::SetItemTooltip("Start captures at the next SECTOR pulse instead of INDEX; tracks are rotated into sector order on the device");
+			ImGui::SameLine();
+			ImGui::CheckboxFlags("Auto-tune gaps##autotune", &batch_flags, BATCH_FLAG_AUTO_TUNE);
+			ImGui::SetItemTooltip("Open read gate as late as measured SYNC positions allow (per head and cylinder zone); see SYNC positions in DIAGNOSTICS");
 
 			if (ImGui::Button("Proper Batch Read (0adj)")) {
-				com_enqueue("%s %d %d %d %d %d %d",
-					CMDSTR_op_read_batch,
+				enqueue_batch_read(
 					0,
 					n_cyls,
 					((1 << DRIVE_HEAD_COUNT)-1),
 					MAX_DATA_BUFFER_SIZE,
 					0,
-					0);
+					0,
+					batch_max_retries,
+					batch_flags);
 			}
 			ImGui::SameLine();
 			if (ImGui::Button("(3adj)")) {
-				com_enqueue("%s %d %d %d %d %d %d",
-					CMDSTR_op_read_batch,
+				enqueue_batch_read(
 					0,
 					n_cyls,
 					((1 << DRIVE_HEAD_COUNT)-1),
 					MAX_DATA_BUFFER_SIZE,
 					0,
-					ENTIRE_RANGE);
+					ENTIRE_RANGE,
+					batch_max_retries,
+					batch_flags);
 
 			}
 			ImGui::SameLine();
 			if (ImGui::Button("(9adj)")) {
-				com_enqueue("%s %d %d %d %d %d %d",
-					CMDSTR_op_read_batch,
+				enqueue_batch_read(
 					0,
 					n_cyls,
 					((1 << DRIVE_HEAD_COUNT)-1),
 					MAX_DATA_BUFFER_SIZE,
 					ENTIRE_RANGE,
-					ENTIRE_RANGE);
+					ENTIRE_RANGE,
+					batch_max_retries,
+					batch_flags);
+
+			}
+
+			ImGui::SameLine();
+			if (ImGui::Button("(adaptive)")) {
+				enqueue_batch_read(
+					0,
+					n_cyls,
+					((1 << DRIVE_HEAD_COUNT)-1),
+					MAX_DATA_BUFFER_SIZE,
+					ADAPTIVE,
+					ADAPTIVE,
+					batch_max_retries,
+					batch_flags);
+			}
+			ImGui::SetItemTooltip("Reads at neutral and only tries the 8 other servo/strobe adjustments on tracks with CRC errors");
 
+			if (last_batch.is_set && com.n_batch_checkpoints != last_batch.n_checkpoints0) {
+				ImGui::SameLine();
+				if (ImGui::Button("Resume batch")) enqueue_batch_resume();
+				ImGui::SetItemTooltip("Continues the last batch read after cylinder %d head %d adjustment %d, the last track transferred",
+					com.batch_checkpoint[0], com.batch_checkpoint[1], com.batch_checkpoint[2]);
+			}
+
+			ImGui::SameLine();
+			if (ImGui::Button("Buffer stats")) {
+				com_enqueue("%s", CMDSTR_buffer_stats);
 			}
+			ImGui::SetItemTooltip("Logs capture ring buffer usage, high water mark and producer stalls");
+
+			ImGui::SameLine();
+			if (ImGui::Button("Base64 bench")) {
+				com_enqueue("%s", CMDSTR_base64_bench);
+			}
+			ImGui::SetItemTooltip("Logs the controller's base64 encoder throughput (for text mode transfers) in bytes/cycle");
 
 			ImGui::SameLine();
 			if (ImGui::Button("Reset")) {
@@ -852,6 +1512,181 @@ int main(int argc, char** argv)
 				com_enqueue("%s %d", CMDSTR_op_broken_seek, broken_seek_cylinder);
 			}
 
+			if (ImGui::TreeNode("Tag timing")) {
+				static int tag_setup_ns = TAG_TIMING_DEFAULT_NS;
+				static int tag_hold_ns = TAG_TIMING_DEFAULT_NS;
+				if (ImGui::Button("Calibrate")) {
+					com_enqueue("%s", CMDSTR_op_calibrate_tag_timing);
+				}
+				ImGui::SetItemTooltip("Seeks between cylinders 255 and 256 with shorter and shorter tag hold and setup times, and keeps the shortest that work (with a margin)");
+				ImGui::InputInt("Setup (ns)", &tag_setup_ns);
+				ImGui::InputInt("Hold (ns)", &tag_hold_ns);
+				if (tag_setup_ns < 0) tag_setup_ns = 0;
+				if (tag_hold_ns < 0) tag_hold_ns = 0;
+				if (tag_setup_ns > TAG_TIMING_DEFAULT_NS) tag_setup_ns = TAG_TIMING_DEFAULT_NS;
+				if (tag_hold_ns > TAG_TIMING_DEFAULT_NS) tag_hold_ns = TAG_TIMING_DEFAULT_NS;
+				if (ImGui::Button("Set")) {
+					com_enqueue("%s %d %d", CMDSTR_set_tag_timing, tag_setup_ns, tag_hold_ns);
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Defaults")) {
+					com_enqueue("%s 0 0", CMDSTR_set_tag_timing);
+				}
+				ImGui::TreePop();
+			}
+
+			if (ImGui::TreeNode("Sector layout")) {
+				ImGui::InputInt("Sectors", &sector_layout[0]);
+				ImGui::InputInt("Gap-A wait (servo clocks)", &sector_layout[1]);
+				ImGui::InputInt("Address field (bytes)", &sector_layout[2]);
+				ImGui::InputInt("Gap-B wait (servo clocks)", &sector_layout[3]);
+				ImGui::InputInt("Data field (bytes)", &sector_layout[4]);
+				ImGui::InputInt("Data tail (bytes)", &sector_layout[5]);
+				ImGui::InputInt("SYNC", &sector_layout[6], 1, 16, ImGuiInputTextFlags_CharsHexadecimal);
+				ImGui::InputInt("Sector number byte (-1=none)", &sector_layout[7]);
+				for (int i = 0; i < 7; i++) if (sector_layout[i] < 0) sector_layout[i] = 0;
+				if (sector_layout[7] < -1) sector_layout[7] = -1;
+				if (ImGui::Button("Upload")) {
+					com_enqueue("%s %d %d %d %d %d %d %d %d",
+						CMDSTR_set_sector_layout,
+						sector_layout[0],
+						sector_layout[1],
+						sector_layout[2],
+						sector_layout[3],
+						sector_layout[4],
+						sector_layout[5],
+						sector_layout[6],
+						sector_layout[7]);
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("CR8044")) {
+					memcpy(sector_layout, cr8044_sector_layout, sizeof sector_layout);
+				}
+				ImGui::TreePop();
+			}
+
+			if (ImGui::TreeNode("Track list (job script)")) {
+				static char track_list[1<<14] = "";
+				static int* tracks_arr = NULL;
+				ImGui::InputTextMultiline("##tracklist", track_list, IM_ARRAYSIZE(track_list), ImVec2(-FLT_MIN, ImGui::GetTextLineHeight() * 8));
+				ImGui::SetItemTooltip("One track per line: <cylinder> <head> [<servo offset> <data strobe delay>]; read as one job");
+				static bool is_elevator = true;
+				static bool is_single_step = false;
+				ImGui::Checkbox("Elevator order", &is_elevator);
+				ImGui::SetItemTooltip("Let the controller order the tracks to minimise head travel (SCAN); otherwise they're read in list order");
+				ImGui::SameLine();
+				ImGui::Checkbox("Single-step seeks", &is_single_step);
+				ImGui::SetItemTooltip("Seek one cylinder at a time (as Broken Seek), for drives that can't coarse seek; otherwise seeks are direct, falling back to single steps where they fail");
+				const int n_tracks = parse_track_list(track_list, &tracks_arr, common_servo_offset, common_data_strobe_delay);
+				// worst case: adjustment, seek and read per track
+				const int max_tracks = (SCRIPT_MAX_STEPS - 4) / 3;
+				if (n_tracks < 0) {
+					ImGui::Text("bad track list");
+				} else {
+					ImGui::Text("%d tracks", n_tracks);
+				}
+				ImGui::SameLine();
+				ImGui::BeginDisabled(n_tracks <= 0 || n_tracks > max_tracks);
+				if (ImGui::Button("Read tracks")) {
+					enqueue_track_list_script(tracks_arr, n_tracks, batch_max_retries, batch_flags, is_elevator, is_single_step ? SEEK_MODE_SINGLE_STEP : SEEK_MODE_HYBRID);
+				}
+				ImGui::EndDisabled();
+				ImGui::SetItemTooltip("Tracks without an adjustment use the common servo offset and data strobe delay; uses the batch retries and flags");
+				ImGui::SameLine();
+				if (ImGui::Button("Bad tracks")) {
+					char* wp = track_list;
+					char* end = track_list + sizeof track_list;
+					wp[0] = 0;
+					for (int i = 0; i+1 < arrlen(com.bad_tracks_arr) && (end - wp) > 16; i += 2) {
+						wp += snprintf(wp, end - wp, "%d %d\n", com.bad_tracks_arr[i], com.bad_tracks_arr[i+1]);
+					}
+				}
+				ImGui::SetItemTooltip("Lists the downloaded tracks that had CRC failures (%d), for re-reading", (int)arrlen(com.bad_tracks_arr)/2);
+				ImGui::TreePop();
+			}
+
+			if (ImGui::TreeNode("SYNC positions")) {
+				if (ImGui::Button("Fetch")) {
+					com_enqueue("%s 0", CMDSTR_sync_histograms);
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Fetch and reset")) {
+					com_enqueue("%s 1", CMDSTR_sync_histograms);
+				}
+				for (int head = 0; head < DRIVE_HEAD_COUNT; head++) {
+					for (int zone = 0; zone < MAX_SYNC_ZONES; zone++) {
+						for (int field = 0; field < 2; field++) {
+							const struct sync_histogram* h = &com.sync_histograms[head][zone][field];
+							if (h->n_samples == 0) continue;
+							char label[1<<8];
+							snprintf(label, sizeof label, "head %d, cyl %d+, %s SYNC: %d..%d bits after %s",
+								head,
+								h->first_cylinder,
+								field == 0 ? "address" : "data",
+								h->origin,
+								h->origin + h->n_bins * h->bin_width,
+								field == 0 ? "SECTOR" : "address field");
+							char overlay[1<<8];
+							if (h->tuned_wait > 0) {
+								snprintf(overlay, sizeof overlay, "%u samples; tuned wait: %u", h->n_samples, h->tuned_wait);
+							} else {
+								snprintf(overlay, sizeof overlay, "%u samples; too few to tune", h->n_samples);
+							}
+							ImGui::TextUnformatted(label);
+							ImGui::PushID(head*MAX_SYNC_ZONES*2 + zone*2 + field);
+							ImGui::PlotHistogram("", h->counts, h->n_bins, 0, overlay, 0.0f, FLT_MAX, ImVec2(0, 60));
+							ImGui::PopID();
+						}
+					}
+				}
+				ImGui::TreePop();
+			}
+
+			if (ImGui::TreeNode("Seek times")) {
+				if (ImGui::Button("Fetch")) {
+					com_enqueue("%s 0", CMDSTR_seek_profile);
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Fetch and reset")) {
+					com_enqueue("%s 1", CMDSTR_seek_profile);
+				}
+				ImGui::SetItemTooltip("Response is TAG1 to ON CYLINDER low (only seen within the fixed 1ms wait); seek is TAG1 to SEEK END");
+				if (ImGui::BeginTable("seekprofile", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+					ImGui::TableSetupColumn("distance");
+					ImGui::TableSetupColumn("direction");
+					ImGui::TableSetupColumn("seeks");
+					ImGui::TableSetupColumn("errors");
+					ImGui::TableSetupColumn("response min/mean/max");
+					ImGui::TableSetupColumn("seek min/mean/max");
+					ImGui::TableHeadersRow();
+					for (int band = 0; band < MAX_SEEK_BANDS; band++) {
+						for (int direction = 0; direction < 2; direction++) {
+							const struct seek_profile_entry* e = &com.seek_profile[band][direction];
+							if (e->seek.n == 0 && e->n_errors == 0) continue;
+							ImGui::TableNextRow();
+							ImGui::TableNextColumn();
+							ImGui::Text("%d-%d", e->first_distance, e->last_distance);
+							ImGui::TableNextColumn();
+							ImGui::TextUnformatted(direction == 0 ? "forward" : "reverse");
+							ImGui::TableNextColumn();
+							ImGui::Text("%u", e->seek.n);
+							ImGui::TableNextColumn();
+							ImGui::Text("%u", e->n_errors);
+							ImGui::TableNextColumn();
+							ImGui::Text("%.2f/%.2f/%.2fms", e->response.min_us*1e-3, e->response.mean_us*1e-3, e->response.max_us*1e-3);
+							if (e->n_unseen_responses > 0) {
+								ImGui::SameLine();
+								ImGui::Text("(%u unseen)", e->n_unseen_responses);
+							}
+							ImGui::TableNextColumn();
+							ImGui::Text("%.1f/%.1f/%.1fms", e->seek.min_us*1e-3, e->seek.mean_us*1e-3, e->seek.max_us*1e-3);
+						}
+					}
+					ImGui::EndTable();
+				}
+				ImGui::TreePop();
+			}
+
 			#ifdef TELEMETRY_LOG
 			ImGui::SeparatorText("Write to telemetry.log");
 			static char telemtry_log_message[1<<10] = "";
@@ -883,11 +1718,32 @@ int main(int argc, char** argv)
 			#define PIN(TYPE,NAME,GPN) \
 				if (TYPE==FREQ) { \
 					ImGui::SameLine(FW+fi*FW); \
-					ImGui::Text(#NAME ": %uhz", com.frequencies[fi++]); \
+					ImGui::Text(#NAME ": %.3fhz", (double)com.frequencies[fi++] * 1e-3); \
 				}
 			EMIT_PIN_CONFIG
 			#undef PIN
 
+			{
+				const struct revolution_timing* t = &com.revolution_timing;
+				if (t->n > 0) {
+					ImGui::Text("Revolution: %.4fms (min %.4fms / max %.4fms / stddev %.2fus) over %u",
+						(double)t->mean_ns * 1e-6,
+						(double)t->min_ns * 1e-6,
+						(double)t->max_ns * 1e-6,
+						(double)t->stddev_ns * 1e-3,
+						t->n);
+				} else {
+					ImGui::Text("Revolution: no INDEX");
+				}
+				if (t->n_dropped > 0) {
+					ImGui::SameLine();
+					ImGui::Text("(%u dropped)", t->n_dropped);
+				}
+			}
+			if (com.n_status_events_lost > 0) {
+				ImGui::Text("Status edges lost to a full ring: %u", com.n_status_events_lost);
+			}
+
 			ImGui::SliderFloat("scale", &status_scope_scale, 1.0f, 60.0f, "%.1f seconds");
 
 			#define MAX_NAMES (30)
@@ -905,49 +1761,79 @@ int main(int argc, char** argv)
 			if (ImGui::BeginTable("table", n_columns)) {
 				ImGui::TableSetupColumn("0", ImGuiTableColumnFlags_WidthStretch);
 				ImGui::TableSetupColumn("1", ImGuiTableColumnFlags_WidthFixed);
-				const struct controller_status* cs = com.controller_status_arr;
-				const int ncs = arrlen(cs);
+				const struct status_store* ss = &com.status_store;
+				const int64_t first = status_store_first(ss);
+				// OR/AND of the statuses under each pixel column of the
+				// scope, shared by all rows
+				static struct status_block px_status[MAX_SCOPE_PIXELS];
+				int n_px = 0;
 				for (int row = 0; row < n_status_names; row++) {
 					const unsigned mask = 1 << row;
 					const char* label = status_names[row];
 					ImU32 st0col = get_status_label_color(label, 0);
 					ImU32 st1col = get_status_label_color(label, 1);
+					ImU32 st2col = get_status_label_color(label, 2);
 
 					ImGui::TableNextRow();
 					ImGui::TableSetColumnIndex(0);
 
 					int eps_count = 0;
-					if (ncs > 0) {
-						const int64_t ts_horizon = now_us - (int64_t)(status_scope_scale * 1e6f);
+					if (ss->n > 0) {
 						ImVec2 area_p0 = ImGui::GetCursorScreenPos();
 						ImVec2 area_sz = ImGui::GetContentRegionAvail();
+						if (row == 0) {
+							n_px = (int)area_sz.x;
+							if (n_px < 0) n_px = 0;
+							if (n_px > MAX_SCOPE_PIXELS) n_px = MAX_SCOPE_PIXELS;
+							const int64_t span_us = (int64_t)(status_scope_scale * 1e6f);
+							const int64_t ts_horizon = now_us - span_us;
+							int64_t i0 = status_store_lower_bound(ss, first, ts_horizon);
+							for (int px = 0; px < n_px; px++) {
+								const int64_t t1 = ts_horizon + (span_us * (px+1)) / n_px;
+								const int64_t i1 = status_store_lower_bound(ss, i0, t1);
+								// the status going into the column, unknown
+								// (off) before the first one
+								struct status_block* b = &px_status[px];
+								b->any = b->all = i0 > first ? status_store_get(ss, i0-1)->status : 0;
+								status_store_combine(ss, i0, i1, b);
+								i0 = i1;
+							}
+						}
+
+						// runs of columns where it was on all of the
+						// time (2) or only some of it (1)
 						ImDrawList* draw_list = ImGui::GetWindowDrawList();
-						float x_right = area_p0.x+area_sz.x;
-						for (int cursor = ncs-1; cursor >= 0 && draw_list->_VtxCurrentIdx < (1<<15); cursor--) {
-							const struct controller_status* st = &cs[cursor];
-							const double q = (double)(st->timestamp_us - ts_horizon) / (double)(now_us - ts_horizon);
-							const int on = (st->status & mask) != 0;
-							const int prev_on = cursor == 0 ? 0 : (cs[cursor-1].status & mask) != 0;
-							const int edge = (on != prev_on);
-							const float x_left = area_p0.x + area_sz.x*q;
-							if (edge && (now_us - st->timestamp_us) < 1000000) {
-								eps_count++;
+						int run0 = -1, run_level = 0;
+						for (int px = 0; px <= n_px; px++) {
+							int level = 0;
+							if (px < n_px) {
+								if (px_status[px].all & mask) {
+									level = 2;
+								} else if (px_status[px].any & mask) {
+									level = 1;
+								}
 							}
-							if (on && edge) { // 1->0
+							if (level == run_level) continue;
+							if (run_level > 0) {
 								draw_list->AddRectFilled(
-									ImVec2(x_left, area_p0.y),
-									ImVec2(x_right, area_p0.y+font_size),
-									st1col);
-							}
-							if (!on && edge) { // 0->1
-								x_right = x_left;
+									ImVec2(area_p0.x + run0, area_p0.y),
+									ImVec2(area_p0.x + px, area_p0.y+font_size),
+									run_level == 2 ? st1col : st2col);
 							}
-							if (x_right < area_p0.x) break;
+							run0 = px;
+							run_level = level;
+						}
+
+						const struct controller_status* last = status_store_get(ss, ss->n-1);
+						const int64_t i = status_store_lower_bound(ss, first, now_us - 1000000);
+						if (i < ss->n) {
+							const struct controller_status* before = status_store_get(ss, i > first ? i-1 : i);
+							eps_count = (uint16_t)(last->n_edges[row] - before->n_edges[row]);
 						}
 					}
 
 					ImGui::TableSetColumnIndex(1);
-					const int is_on = (ncs > 0) && (cs[ncs-1].status & mask);
+					const int is_on = (ss->n > 0) && (status_store_get(ss, ss->n-1)->status & mask);
 					ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, is_on ? st1col : st0col);
 					{
 						char txt[1<<12];
@@ -1012,15 +1898,23 @@ int main(int argc, char** argv)
 				ImGui::CheckboxFlags("Head 4", &batch_head_set, 1<<4);
 				ImGui::InputInt("32bit Word Count", &common_32bit_word_count);
 				if (common_32bit_word_count < 0) common_32bit_word_count = 0;
+				ImGui::InputInt("Retries", &batch_max_retries);
+				if (batch_max_retries < 0) batch_max_retries = 0;
+				ImGui::CheckboxFlags("Pipelined", &batch_flags, BATCH_FLAG_PIPELINED);
+				ImGui::SameLine();
+				ImGui::CheckboxFlags("Any sector", &batch_flags, BATCH_FLAG_ANY_SECTOR);
+				ImGui::SameLine();
+				ImGui::CheckboxFlags("Auto-tune gaps", &batch_flags, BATCH_FLAG_AUTO_TUNE);
 				if (ImGui::Button("Execute!")) {
-					com_enqueue("%s %d %d %d %d %d %d",
-						CMDSTR_op_read_batch,
+					enqueue_batch_read(
 						batch_cylinder0,
 						batch_cylinder1,
 						batch_head_set,
 						common_32bit_word_count,
 						common_servo_offset,
-						common_data_strobe_delay);
+						common_data_strobe_delay,
+						batch_max_retries,
+						batch_flags);
 				}
 			}
 
@@ -1210,8 +2104,8 @@ int main(int argc, char** argv)
 		current_controls = debug_control_pins;
 		if (has_com) {
 			pthread_rwlock_rdlock(&com.rwlock);
-			const int n = arrlen(com.controller_status_arr);
-			current_st = n == 0 ? 0 : com.controller_status_arr[n-1].status;
+			const struct status_store* ss = &com.status_store;
+			current_st = ss->n == 0 ? 0 : status_store_get(ss, ss->n-1)->status;
 			pthread_rwlock_unlock(&com.rwlock);
 		}
 		telemetry_log_status();
@@ -0,0 +1,182 @@
+// cc -O2 -I.. com_scan_bench.c -o com_scan_bench && ./com_scan_bench [recorded stream]
+// Replays a controller stream through the frontend's line/frame scanner
+// (frontend_graphical/com_scan.h) and the integer parsing it uses for the
+// frequent messages, in read()-sized chunks, and reports the throughput.
+// Record a stream with e.g. `cat /dev/ttyACM0 > stream` while the frontend
+// runs a batch read; without one, a text mode batch read (F1 lines) with
+// status traffic and some binary frames is synthesized.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "controller_protocol.h"
+#include "frontend_graphical/com_scan.h"
+#include "adler32.c"
+#include "base64.c"
+
+#define READ_SIZE (1<<16)
+#define MIN_BYTES (1LL<<30)
+
+void PANIC(uint32_t error) { fprintf(stderr, "PANIC(%d)\n", error); abort(); }
+
+struct counts {
+	long long n_lines;
+	long long n_frames;
+	long long n_frame_bytes;
+	long long n_bad;
+	int64_t sum; // of parsed values, so they aren't optimized away
+};
+
+static int is_code(const char* s, const char* cppp)
+{
+	return s[0] == cppp[0] && s[1] == cppp[1] && (s[2] == ' ' || s[2] == 0);
+}
+
+static void handle_line(void* ctx, char* line)
+{
+	struct counts* c = ctx;
+	c->n_lines++;
+	char* tail = line + 2;
+	int64_t v0 = 0, v1 = 0;
+	uint32_t u = 0;
+	int seq = 0;
+	if (is_code(line, CPPP_DATA_LINE)) {
+		char* b64 = NULL;
+		if (com_parse_int(&tail, &seq) && (b64 = com_parse_token(&tail)) != NULL) {
+			c->sum += seq + b64[0];
+		} else {
+			c->n_bad++;
+		}
+	} else if (is_code(line, CPPP_STATUS_EVENTS)) {
+		if (!com_parse_u32(&tail, &u)) c->n_bad++;
+		while (com_parse_i64(&tail, &v0) && com_parse_i64(&tail, &v1)) c->sum += v0 + v1;
+	} else if (is_code(line, CPPP_STATUS) || is_code(line, CPPP_FREQ) || is_code(line, CPPP_DATA_FOOTER)) {
+		if (com_parse_i64(&tail, &v0) && com_parse_i64(&tail, &v1)) {
+			c->sum += v0 + v1;
+		} else {
+			c->n_bad++;
+		}
+	} else if (is_code(line, CPPP_TIME)) {
+		if (com_parse_i64(&tail, &v0)) {
+			c->sum += v0;
+		} else {
+			c->n_bad++;
+		}
+	}
+}
+
+static void handle_frame(void* ctx, const struct xfer_frame_header* header, const uint8_t* payload)
+{
+	struct counts* c = ctx;
+	c->n_frames++;
+	c->n_frame_bytes += header->length;
+	c->sum += payload[0];
+}
+
+static void handle_bad_frame(void* ctx, const struct xfer_frame_header* header)
+{
+	struct counts* c = ctx;
+	c->n_bad++;
+}
+
+static char* synthesize(size_t* size)
+{
+	const size_t cap = 64 << 20;
+	char* stream = malloc(cap);
+	char* wp = stream;
+	uint8_t data[1<<12];
+	srand(42);
+	uint64_t t = 1000000;
+	while ((size_t)(wp - stream) < cap - (1<<14)) {
+		for (int i = 0; i < sizeof data; i++) data[i] = rand();
+		if (rand() & 1) {
+			// text mode track: 60 bytes per base64 line
+			wp += sprintf(wp, "%s 3840 cylinder100-head3.cr8044read\r\n", CPPP_DATA_HEADER);
+			int seq = 0;
+			for (int i = 0; i < 3840; i += 60) {
+				wp += sprintf(wp, "%s %d ", CPPP_DATA_LINE, seq++);
+				wp = base64_encode(wp, data + (i % (sizeof data - 60)), 60);
+				wp += sprintf(wp, "\r\n");
+			}
+			wp += sprintf(wp, "%s %d %u\r\n", CPPP_DATA_FOOTER, seq, adler32(data, 3840));
+		} else {
+			// binary mode track
+			wp += sprintf(wp, "%s 4096 cylinder100-head4.cr8044read\r\n", CPPP_DATA_HEADER);
+			wp = (char*)xfer_frame_encode_header((uint8_t*)wp, 0, data, sizeof data);
+			memcpy(wp, data, sizeof data);
+			wp += sizeof data;
+			wp += sprintf(wp, "%s 1 %u\r\n", CPPP_DATA_FOOTER, adler32(data, sizeof data));
+		}
+		t += 16667;
+		wp += sprintf(wp, "%s 0 %llu 18 12 20 3 4 21\r\n", CPPP_STATUS_EVENTS, (unsigned long long)t);
+		wp += sprintf(wp, "%s 0 60012\r\n%s 1 1920384\r\n", CPPP_FREQ, CPPP_FREQ);
+		wp += sprintf(wp, "%s %llu\r\n", CPPP_TIME, (unsigned long long)t);
+	}
+	*size = wp - stream;
+	return stream;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [recorded stream]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	size_t size = 0;
+	char* stream = NULL;
+	if (argc == 2) {
+		FILE* f = fopen(argv[1], "rb");
+		if (f == NULL) {
+			perror(argv[1]);
+			exit(EXIT_FAILURE);
+		}
+		fseek(f, 0, SEEK_END);
+		size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		stream = malloc(size);
+		if (fread(stream, 1, size, f) != size) {
+			fprintf(stderr, "%s: short read\n", argv[1]);
+			exit(EXIT_FAILURE);
+		}
+		fclose(f);
+	} else {
+		stream = synthesize(&size);
+	}
+	if (size == 0) {
+		fprintf(stderr, "empty stream\n");
+		exit(EXIT_FAILURE);
+	}
+
+	static struct com_scan cs;
+	static char buf[READ_SIZE];
+	const struct com_scan_handlers handlers = { handle_line, handle_frame, handle_bad_frame };
+	struct counts counts = {0};
+	long long n_bytes = 0;
+	int n_replays = 0;
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (n_bytes < MIN_BYTES) {
+		for (size_t offset = 0; offset < size; offset += READ_SIZE) {
+			// the scanner writes into the buffer, so copy like read() does
+			const size_t n = (size - offset) < READ_SIZE ? (size - offset) : READ_SIZE;
+			memcpy(buf, stream + offset, n);
+			com_scan_push(&cs, buf, n, &handlers, &counts);
+		}
+		n_bytes += size;
+		n_replays++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	const double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+	printf("%zd byte stream x%d: %lld lines, %lld frames (%lld bytes), %lld bad, %u overlong (checksum %lld)\n",
+		size, n_replays,
+		counts.n_lines, counts.n_frames, counts.n_frame_bytes, counts.n_bad, cs.n_overlong_lines,
+		(long long)counts.sum);
+	printf("%.1f MB/s\n", (double)n_bytes / seconds * 1e-6);
+	return counts.n_bad > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
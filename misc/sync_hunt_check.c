@@ -0,0 +1,139 @@
+// cc -I.. sync_hunt_check.c -o sync_hunt_check && ./sync_hunt_check <dump.nrz> [gap-a wait] [gap-b wait]
+// Replays the field-gated reader (cr8044read.pio) on a raw read (INDEX
+// aligned, e.g. from "Raw read") and compares the old SYNC detection
+// (trigger on the first 1-bit after the gap wait) with the SYNC hunt
+// (8-bit windows starting at 1-bits, compared with SYNC). Gaps are counted
+// in bits rather than SERVO_CLOCK cycles, which is close enough.
+// The hunt is modelled on the PIO program: windows don't overlap (a rejected
+// window is skipped whole, and the next one starts at the next 1-bit after
+// it), and the hunt gives up at the end of the sector (the next SECTOR
+// pulse), checked before each bit until a 1-bit and between windows.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bits.h"
+#include "drive.h"
+
+#define BITS_PER_SECTOR   (5028) // see cr80_extract.c
+#define N_SECTORS         (32)
+#define ADDRESS_BITS      (9*8)
+#define DATA_BITS         (551*8)
+#define DATA_READ_BITS    (552*8) // including EOS
+#define SYNC_BYTE         (0x9D)  // 10111001, LSB first
+#define PAD_BITS(n)       ((((n) + 31) & ~31) - (n))
+
+struct method {
+	const char* name;
+	int n_address_ok;
+	int n_data_ok;
+	int n_retries;
+	int n_give_ups;
+};
+
+// returns offset of the first 1-bit at or after `p`, or -1
+static int find_one(struct bits bits, int p, int end)
+{
+	for (; p < end && p < bits.n; p++) if (bits.bd[p]) return p;
+	return -1;
+}
+
+static int first_one(struct bits bits, int gate, int end, struct method* m)
+{
+	return find_one(bits, gate, end);
+}
+
+static int sync_hunt(struct bits bits, int gate, int end, struct method* m)
+{
+	int p = gate;
+	for (;;) {
+		p = find_one(bits, p, end);
+		if (p < 0) {
+			m->n_give_ups++;
+			return -1;
+		}
+		if (bits_u8(bits_slice(bits, p, 8)) == SYNC_BYTE) return p;
+		m->n_retries++;
+		p += 8; // like the PIO; see cr8044read.pio
+	}
+}
+
+static int field_ok(struct bits bits, int p, int n_crc_bits)
+{
+	struct bits field = bits_slice(bits, p, n_crc_bits);
+	return field.n == n_crc_bits && bits_u8(field) == SYNC_BYTE && bits_crc16(field) == 0;
+}
+
+typedef int (*find_sync_fn)(struct bits, int, int, struct method*);
+
+// reads one sector like the PIO does; bit 0 of the result is set if the
+// address field is OK, bit 1 if the data field is
+static int read_sector(struct bits bits, int offset, int gap_a_wait, int gap_b_wait, find_sync_fn find_sync, int pad, struct method* m)
+{
+	const int end = offset + BITS_PER_SECTOR;
+	int result = 0;
+	const int a = find_sync(bits, offset + gap_a_wait, end, m);
+	if (a < 0) return 0;
+	if (field_ok(bits, a, ADDRESS_BITS)) result |= 1;
+	const int address_pad = pad ? PAD_BITS(ADDRESS_BITS) : 0;
+	const int gap_b = gap_b_wait > address_pad ? gap_b_wait - address_pad : 1;
+	const int d = find_sync(bits, a + ADDRESS_BITS + address_pad + gap_b, end, m);
+	if (d < 0) return result;
+	if (field_ok(bits, d, DATA_BITS)) result |= 2;
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 2 && argc != 4) {
+		fprintf(stderr, "Usage: %s <dump.nrz> [gap-a wait] [gap-b wait]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	const int gap_a_wait = argc == 4 ? atoi(argv[2]) : 32;
+	const int gap_b_wait = argc == 4 ? atoi(argv[3]) : 32;
+
+	struct bits bits = bits_load_lsb_first(argv[1]);
+	const int bits_per_track = 8*DRIVE_BYTES_PER_TRACK;
+
+	struct method first = { .name = "first 1-bit" };
+	struct method hunt  = { .name = "SYNC hunt" };
+	int n_sectors = 0;
+	int n_recovered = 0;
+	int n_lost = 0;
+	for (int rev = 0; (rev+1)*bits_per_track <= bits.n; rev++) {
+		for (int s = 0; s < N_SECTORS; s++) {
+			const int offset = rev*bits_per_track + s*BITS_PER_SECTOR;
+			const int r0 = read_sector(bits, offset, gap_a_wait, gap_b_wait, first_one, 0, &first);
+			const int r1 = read_sector(bits, offset, gap_a_wait, gap_b_wait, sync_hunt, 1, &hunt);
+			n_sectors++;
+			first.n_address_ok += (r0 & 1) != 0;
+			first.n_data_ok    += (r0 & 2) != 0;
+			hunt.n_address_ok  += (r1 & 1) != 0;
+			hunt.n_data_ok     += (r1 & 2) != 0;
+			n_recovered += __builtin_popcount(r1 & ~r0);
+			n_lost      += __builtin_popcount(r0 & ~r1);
+			if (r0 != r1) {
+				printf("REV %d SECTOR %.2d: address %s/%s, data %s/%s (first 1-bit/SYNC hunt)\n",
+					rev, s,
+					(r0 & 1) ? "OK" : "BAD", (r1 & 1) ? "OK" : "BAD",
+					(r0 & 2) ? "OK" : "BAD", (r1 & 2) ? "OK" : "BAD");
+			}
+		}
+	}
+
+	printf("%d sectors (gap-a wait %d, gap-b wait %d)\n", n_sectors, gap_a_wait, gap_b_wait);
+	struct method* methods[] = { &first, &hunt };
+	for (int i = 0; i < 2; i++) {
+		struct method* m = methods[i];
+		printf("%-12s address OK: %d  data OK: %d", m->name, m->n_address_ok, m->n_data_ok);
+		if (m->n_retries > 0) printf("  false SYNC candidates: %d (%d bits skipped)", m->n_retries, 8*m->n_retries);
+		if (m->n_give_ups > 0) printf("  given up at SECTOR: %d", m->n_give_ups);
+		printf("\n");
+	}
+	printf("fields recovered by SYNC hunt: %d; lost: %d\n", n_recovered, n_lost);
+
+	return EXIT_SUCCESS;
+}
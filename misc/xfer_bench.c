@@ -0,0 +1,160 @@
+// cc -O2 -I.. xfer_bench.c -o xfer_bench && ./xfer_bench [n tracks]
+// Compares the base64 text transfer path (CPPP_DATA_LINE) with binary frames
+// (xfer_frame.h): wire overhead, and encode/decode throughput on the host
+// using the same code as controller.c/spcfront.cpp.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "controller_protocol.h"
+#include "base.h"
+#include "base64.h"
+void PANIC(uint32_t error) { fprintf(stderr, "PANIC(%d)\n", error); abort(); }
+#include "base64.c"
+#include "adler32.h"
+#include "adler32.c"
+#include "xfer_frame.h"
+
+#define BYTES_PER_LINE  (60)  // must match DATA_TRANSFER_BYTES_PER_LINE in controller.c
+#define BYTES_PER_FRAME (1<<10) // must match DATA_TRANSFER_BYTES_PER_FRAME in controller.c
+#define TRACK_SIZE      (MAX_DATA_BUFFER_SIZE)
+
+// estimated practical USB full-speed CDC throughput
+#define USB_BYTES_PER_SECOND (1000000.0)
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static size_t text_encode(char* dst, uint8_t* src, size_t n, int* sequence)
+{
+	char* wp = dst;
+	for (size_t off = 0; off < n; off += BYTES_PER_LINE) {
+		const size_t nl = (n-off) > BYTES_PER_LINE ? BYTES_PER_LINE : (n-off);
+		wp += sprintf(wp, "%s %.05d ", CPPP_DATA_LINE, (*sequence)++);
+		wp = base64_encode(wp, src+off, nl);
+		*(wp++) = '\n';
+	}
+	return wp - dst;
+}
+
+static size_t text_decode(uint8_t* dst, char* src, size_t n)
+{
+	uint8_t* wp = dst;
+	char* rp = src;
+	char* end = src + n;
+	int expected_sequence = 0;
+	while (rp < end) {
+		char* eol = memchr(rp, '\n', end-rp);
+		assert(eol != NULL);
+		*eol = 0;
+		int sequence = -1;
+		char b64[1<<10];
+		assert(sscanf(rp + strlen(CPPP_DATA_LINE), " %d %s", &sequence, b64) == 2);
+		assert(sequence == expected_sequence++);
+		uint8_t* p = base64_decode_line(wp, b64);
+		assert(p != NULL);
+		adler32(wp, p-wp); // frontend also checksums every byte
+		wp = p;
+		*eol = '\n';
+		rp = eol+1;
+	}
+	return wp - dst;
+}
+
+static size_t binary_encode(uint8_t* dst, uint8_t* src, size_t n, unsigned* sequence)
+{
+	uint8_t* wp = dst;
+	for (size_t off = 0; off < n; off += BYTES_PER_FRAME) {
+		const size_t nf = (n-off) > BYTES_PER_FRAME ? BYTES_PER_FRAME : (n-off);
+		wp = xfer_frame_encode_header(wp, (*sequence)++, src+off, nf);
+		memcpy(wp, src+off, nf);
+		wp += nf;
+	}
+	return wp - dst;
+}
+
+static size_t binary_decode(uint8_t* dst, uint8_t* src, size_t n)
+{
+	uint8_t* wp = dst;
+	uint8_t* rp = src;
+	uint8_t* end = src + n;
+	unsigned expected_sequence = 0;
+	while (rp < end) {
+		struct xfer_frame_header header;
+		assert(xfer_frame_decode_header(rp, &header));
+		assert(header.sequence == (expected_sequence++ & 0xffff));
+		rp += XFER_FRAME_HEADER_SIZE;
+		assert(adler32(rp, header.length) == header.checksum);
+		memcpy(wp, rp, header.length);
+		wp += header.length;
+		rp += header.length;
+	}
+	return wp - dst;
+}
+
+static void report(const char* name, size_t n_payload, size_t n_wire, double t_enc, double t_dec)
+{
+	const double mb = (double)n_payload * 1e-6;
+	printf("%-8s wire=%zd bytes (%+.1f%%)  encode=%.1f MB/s  decode=%.1f MB/s  est. USB time=%.2fs\n",
+		name,
+		n_wire,
+		100.0 * ((double)n_wire / (double)n_payload - 1.0),
+		mb / t_enc,
+		mb / t_dec,
+		(double)n_wire / USB_BYTES_PER_SECOND);
+}
+
+int main(int argc, char** argv)
+{
+	const int n_tracks = argc == 2 ? atoi(argv[1]) : 1000;
+	if (n_tracks < 1) {
+		fprintf(stderr, "Usage: %s [n tracks]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	const size_t n = (size_t)n_tracks * TRACK_SIZE;
+
+	uint8_t* src = malloc(n);
+	for (size_t i = 0; i < n; i++) src[i] = rand() & 0xff;
+	uint8_t* dst = malloc(n);
+	char* text = malloc(n*2);
+	uint8_t* bin = malloc(n + (n/BYTES_PER_FRAME+1)*XFER_FRAME_HEADER_SIZE);
+
+	printf("%d tracks of %d bytes (%.1f MB)\n", n_tracks, TRACK_SIZE, (double)n*1e-6);
+
+	{
+		double t0 = now();
+		size_t nw = 0;
+		int sequence = 0;
+		for (int i = 0; i < n_tracks; i++) nw += text_encode(text+nw, src + (size_t)i*TRACK_SIZE, TRACK_SIZE, &sequence);
+		double t1 = now();
+		memset(dst, 0, n);
+		assert(text_decode(dst, text, nw) == n);
+		double t2 = now();
+		assert(memcmp(src, dst, n) == 0);
+		report("text", n, nw, t1-t0, t2-t1);
+	}
+
+	{
+		double t0 = now();
+		size_t nw = 0;
+		unsigned sequence = 0;
+		for (int i = 0; i < n_tracks; i++) nw += binary_encode(bin+nw, src + (size_t)i*TRACK_SIZE, TRACK_SIZE, &sequence);
+		double t1 = now();
+		memset(dst, 0, n);
+		const size_t nr = binary_decode(dst, bin, nw);
+		assert(nr == n);
+		double t2 = now();
+		assert(memcmp(src, dst, n) == 0);
+		report("binary", n, nw, t1-t0, t2-t1);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "hardware/structs/iobank0.h"
+
+#include "pin_events.h"
+#include "base.h"
+
+#define N_GPIOS (30)
+#define EDGES (GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL)
+#define RING_SIZE (1 << PIN_EVENTS_RING_SIZE_LOG2)
+#define RING_MASK (RING_SIZE-1)
+
+static volatile struct pin_edges edges[N_GPIOS];
+static volatile uint32_t watched_mask;
+static uint32_t recorded_mask;
+static int is_alarm_claimed;
+
+// written by the interrupt, read by core0's main loop
+static struct pin_levels ring[RING_SIZE];
+static volatile uint32_t ring_write;
+static volatile uint32_t ring_read;
+static volatile uint32_t n_overflows;
+static uint32_t levels;
+
+// the interrupt is core0's, whichever core watches; and the enables are
+// per core, so gpio_set_irq_enabled() (current core) doesn't do
+static void set_core0_edges_enabled(unsigned gpio, int enabled)
+{
+	io_rw_32* inte = &iobank0_hw->proc0_irq_ctrl.inte[gpio / 8];
+	const uint32_t bits = EDGES << (4 * (gpio % 8));
+	if (enabled) {
+		hw_set_bits(inte, bits);
+	} else {
+		hw_clear_bits(inte, bits);
+	}
+}
+
+static void record_levels(uint32_t timestamp_us)
+{
+	const uint32_t w = ring_write;
+	if ((w - ring_read) >= RING_SIZE) {
+		n_overflows++;
+		return;
+	}
+	struct pin_levels* p = &ring[w & RING_MASK];
+	p->timestamp_us = timestamp_us;
+	p->levels = levels;
+	ring_write = w + 1;
+}
+
+static void gpio_irq_handler(void)
+{
+	const uint32_t now = time_us_32();
+	const uint32_t gpio_all = gpio_get_all();
+	uint32_t mask = watched_mask | recorded_mask;
+	while (mask) {
+		const unsigned gpio = __builtin_ctz(mask);
+		mask &= mask - 1;
+		const uint32_t events = gpio_get_irq_event_mask(gpio) & EDGES;
+		if (events == 0) continue;
+		gpio_acknowledge_irq(gpio, events);
+		volatile struct pin_edges* e = &edges[gpio];
+		if (events & GPIO_IRQ_EDGE_RISE) {
+			e->n_rising++;
+			e->rising_us = now;
+		}
+		if (events & GPIO_IRQ_EDGE_FALL) {
+			e->n_falling++;
+			e->falling_us = now;
+		}
+
+		const uint32_t bit = 1 << gpio;
+		if (!(recorded_mask & bit)) continue;
+		if (events == EDGES) {
+			// a pulse (or more) since the last interrupt: record the
+			// level it went through before the one it ended at
+			levels = (levels & ~bit) | (~gpio_all & bit);
+			record_levels(now);
+			levels ^= bit;
+		} else {
+			levels = (levels & ~bit) | ((events & GPIO_IRQ_EDGE_RISE) ? bit : 0);
+		}
+		record_levels(now);
+	}
+	// sets the event register, so an edge between the waiter's last pin
+	// check and its WFE isn't slept through
+	__sev();
+}
+
+static void alarm_callback(uint alarm_num)
+{
+	__sev();
+}
+
+void pin_events_init(uint32_t record_gpio_mask)
+{
+	recorded_mask = record_gpio_mask;
+	levels = gpio_get_all() & recorded_mask;
+	uint32_t mask = recorded_mask;
+	while (mask) {
+		const unsigned gpio = __builtin_ctz(mask);
+		mask &= mask - 1;
+		if (gpio >= N_GPIOS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+		gpio_acknowledge_irq(gpio, EDGES);
+		set_core0_edges_enabled(gpio, 1);
+	}
+	irq_set_exclusive_handler(IO_IRQ_BANK0, gpio_irq_handler);
+	irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+void pin_events_init_waiter(void)
+{
+	// the watches of a previous (reset) run are still set
+	pin_events_unwatch(watched_mask);
+
+	if (!is_alarm_claimed) {
+		hardware_alarm_claim(PIN_EVENTS_ALARM);
+		is_alarm_claimed = 1;
+	}
+	hardware_alarm_set_callback(PIN_EVENTS_ALARM, alarm_callback);
+	// hardware_alarm_set_callback() only enables the interrupt when it
+	// installs its handler, i.e. on the first run
+	irq_set_enabled(TIMER_IRQ_0 + PIN_EVENTS_ALARM, true);
+}
+
+void pin_events_watch(uint32_t gpio_mask)
+{
+	uint32_t mask = gpio_mask & ~watched_mask;
+	watched_mask |= mask;
+	mask &= ~recorded_mask; // already enabled, and their edges are current
+	while (mask) {
+		const unsigned gpio = __builtin_ctz(mask);
+		mask &= mask - 1;
+		if (gpio >= N_GPIOS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+		gpio_acknowledge_irq(gpio, EDGES); // stale edges
+		set_core0_edges_enabled(gpio, 1);
+	}
+}
+
+void pin_events_unwatch(uint32_t gpio_mask)
+{
+	uint32_t mask = gpio_mask & watched_mask & ~recorded_mask;
+	while (mask) {
+		const unsigned gpio = __builtin_ctz(mask);
+		mask &= mask - 1;
+		set_core0_edges_enabled(gpio, 0);
+	}
+	watched_mask &= ~gpio_mask;
+}
+
+void pin_events_sleep_until(absolute_time_t deadline)
+{
+	if (hardware_alarm_set_target(PIN_EVENTS_ALARM, deadline)) return; // already passed
+	__wfe();
+}
+
+const volatile struct pin_edges* pin_events_get_edges(unsigned gpio)
+{
+	if (gpio >= N_GPIOS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	return &edges[gpio];
+}
+
+int pin_events_pop_levels(struct pin_levels* p)
+{
+	const uint32_t r = ring_read;
+	if (r == ring_write) return 0;
+	*p = ring[r & RING_MASK];
+	ring_read = r + 1;
+	return 1;
+}
+
+uint32_t pin_events_take_n_overflows(void)
+{
+	const uint32_t save = save_and_disable_interrupts();
+	const uint32_t n = n_overflows;
+	n_overflows = 0;
+	restore_interrupts(save);
+	return n;
+}
@@ -0,0 +1,51 @@
+#ifndef PIN_EVENTS_H
+
+// Event-driven waiting for drive status pins, and a log of status pin
+// changes. GPIO edge interrupts are taken by core0 (pin_events_init()): they
+// count and timestamp edges on the watched pins, and log every level change
+// of the recorded pins into a ring that core0's main loop drains. The
+// waiting core (pin_events_init_waiter()) sleeps in WFE in
+// pin_events_sleep_until() until such an edge (the handler's SEV wakes both
+// cores), or until a deadline (a hardware alarm). A wait reacts within the
+// interrupt latency plus a short handler rather than a polling interval, and
+// the core is idle in between.
+
+#include <stdint.h>
+#include "pico/time.h"
+
+#define PIN_EVENTS_ALARM (2) // hardware alarm; the SDK's default alarm pool uses 3
+#define PIN_EVENTS_RING_SIZE_LOG2 (8)
+
+struct pin_edges {
+	uint32_t n_rising;
+	uint32_t n_falling;
+	uint32_t rising_us;  // time_us_32() of the last rising edge
+	uint32_t falling_us;
+};
+
+struct pin_levels {
+	uint32_t timestamp_us; // time_us_32() of the edge
+	uint32_t levels;       // levels of the recorded pins after the edge
+};
+
+// on core0, once; takes the GPIO interrupt, and starts recording level
+// changes of `record_gpio_mask`
+void pin_events_init(uint32_t record_gpio_mask);
+// on the waiting core, every time it's (re)started
+void pin_events_init_waiter(void);
+void pin_events_watch(uint32_t gpio_mask);
+void pin_events_unwatch(uint32_t gpio_mask);
+// WFE until an edge on a watched pin, or `deadline`; may return early
+void pin_events_sleep_until(absolute_time_t deadline);
+// edges on a watched pin (only counted while it's watched, or recorded)
+const volatile struct pin_edges* pin_events_get_edges(unsigned gpio);
+
+// oldest recorded level change; returns 0 if there is none (core0 only).
+// Both edges of a pulse shorter than the interrupt latency are recorded,
+// with the same timestamp.
+int pin_events_pop_levels(struct pin_levels*);
+// level changes lost to a full ring since the last call
+uint32_t pin_events_take_n_overflows(void);
+
+#define PIN_EVENTS_H
+#endif
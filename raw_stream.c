@@ -0,0 +1,191 @@
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+
+#include "raw_stream.h"
+#include "clocked_read.h"
+#include "clocked_read.pio.h"
+#include "pin_config.h"
+#include "base.h"
+
+_Static_assert(clocked_read_DATA == 0 && clocked_read_CLK == 1, "pins are relative to in-base");
+_Static_assert(GPIO_READ_CLOCK == (GPIO_READ_DATA+1), "clocked_read.pio expects CLK right after DATA");
+_Static_assert(RAW_STREAM_RING_SIZE_BITS <= 15, "DMA ring wrap is at most 1<<15 bytes");
+
+enum raw_stream_state {
+	IDLE = 0,
+	CAPTURING,
+	STOPPED,
+};
+
+// DMA write address wraps around ring, which must be aligned to its size.
+// raw reads and buffer producers never run together, so the ring is borrowed
+// from the capture buffers for the duration of a stream
+static uint8_t* ring;
+
+static PIO pio;
+static uint sm;
+static uint dma_channel;
+static uint pc_offset;
+
+static volatile enum raw_stream_state state;
+static unsigned n_words;
+static volatile unsigned n_bytes_captured; // valid once STOPPED
+static volatile int has_overflowed;
+static unsigned consumer_pos;
+
+static uint32_t index_marks[RAW_STREAM_MAX_INDEX_MARKS];
+static volatile unsigned index_mark_write;
+static volatile unsigned index_mark_read;
+
+void raw_stream_init(PIO _pio, uint _dma_channel)
+{
+	pio = _pio;
+	dma_channel = _dma_channel;
+	pc_offset = pio_add_program(pio, &clocked_read_program);
+	sm = pio_claim_unused_sm(pio, true);
+
+	pio_sm_config cfg = clocked_read_program_get_default_config(pc_offset);
+	sm_config_set_in_pins(&cfg, GPIO_READ_DATA);
+	sm_config_set_in_shift(&cfg, /*shift_right=*/true, /*autopush=*/true, /*push_threshold=*/32);
+	sm_config_set_fifo_join(&cfg, PIO_FIFO_JOIN_RX);
+	pio_sm_init(pio, sm, pc_offset, &cfg);
+}
+
+static unsigned get_producer_pos(void)
+{
+	if (state == CAPTURING) {
+		return (n_words - dma_channel_hw_addr(dma_channel)->transfer_count) << 2;
+	}
+	return n_bytes_captured;
+}
+
+void raw_stream_start(unsigned n_32bit_words)
+{
+	if (state != IDLE) PANIC(PANIC_UNEXPECTED_STATE);
+	ring = lend_buffer_memory(RAW_STREAM_RING_SIZE);
+	n_words = n_32bit_words;
+	n_bytes_captured = 0;
+	has_overflowed = 0;
+	consumer_pos = 0;
+	index_mark_write = 0;
+	index_mark_read = 0;
+
+	pio_sm_set_enabled(pio, sm, false);
+	pio_sm_clear_fifos(pio, sm);
+	pio_sm_restart(pio, sm);
+	pio_sm_exec(pio, sm, pio_encode_jmp(pc_offset));
+
+	dma_channel_config cfg = dma_channel_get_default_config(dma_channel);
+	channel_config_set_read_increment(&cfg,  false);
+	channel_config_set_write_increment(&cfg, true);
+	channel_config_set_ring(&cfg, /*write=*/true, RAW_STREAM_RING_SIZE_BITS);
+	channel_config_set_dreq(&cfg, pio_get_dreq(pio, sm, false));
+	dma_channel_configure(
+		dma_channel,
+		&cfg,
+		ring,
+		&pio->rxf[sm],             // read from PIO RX FIFO
+		n_words,
+		true // start now!
+	);
+
+	__dmb();
+	state = CAPTURING;
+	pio_sm_set_enabled(pio, sm, true);
+}
+
+int raw_stream_is_capturing(void)
+{
+	return state == CAPTURING && dma_channel_is_busy(dma_channel);
+}
+
+void raw_stream_mark_index(void)
+{
+	const unsigned w = index_mark_write;
+	if ((w - index_mark_read) >= RAW_STREAM_MAX_INDEX_MARKS) return; // consumer will see a gap in revolutions
+	index_marks[w % RAW_STREAM_MAX_INDEX_MARKS] = get_producer_pos();
+	__dmb();
+	index_mark_write = w+1;
+}
+
+void raw_stream_stop(void)
+{
+	if (state != CAPTURING) return;
+	pio_sm_set_enabled(pio, sm, false);
+	dma_channel_abort(dma_channel);
+	n_bytes_captured = (n_words - dma_channel_hw_addr(dma_channel)->transfer_count) << 2;
+	__dmb();
+	state = STOPPED;
+}
+
+int raw_stream_has_overflowed(void)
+{
+	return has_overflowed;
+}
+
+int raw_stream_is_active(void)
+{
+	return state != IDLE;
+}
+
+unsigned raw_stream_peek(const uint8_t** data)
+{
+	const unsigned p = get_producer_pos();
+	__dmb();
+	if ((p - consumer_pos) > RAW_STREAM_RING_SIZE) {
+		has_overflowed = 1;
+		return 0;
+	}
+	const unsigned offset = consumer_pos & (RAW_STREAM_RING_SIZE-1);
+	unsigned n = p - consumer_pos;
+	if (n > (RAW_STREAM_RING_SIZE - offset)) n = RAW_STREAM_RING_SIZE - offset;
+	*data = ring + offset;
+	return n;
+}
+
+int raw_stream_consume(unsigned n)
+{
+	// the bytes were overwritten if the producer got more than a ring
+	// ahead of them while we were using them
+	if ((get_producer_pos() - consumer_pos) > RAW_STREAM_RING_SIZE) {
+		has_overflowed = 1;
+		return 0;
+	}
+	consumer_pos += n;
+	return 1;
+}
+
+int raw_stream_pop_index(unsigned* byte_offset)
+{
+	const unsigned r = index_mark_read;
+	if (r == index_mark_write) return 0;
+	__dmb();
+	*byte_offset = index_marks[r % RAW_STREAM_MAX_INDEX_MARKS];
+	index_mark_read = r+1;
+	return 1;
+}
+
+int raw_stream_is_done(void)
+{
+	if (state != STOPPED) return 0;
+	if (index_mark_read != index_mark_write) return 0;
+	return has_overflowed || consumer_pos >= n_bytes_captured;
+}
+
+// NOTE: producer must be stopped (e.g. core1 reset)
+void raw_stream_end(void)
+{
+	raw_stream_stop();
+	if (state != IDLE) return_buffer_memory();
+	state = IDLE;
+}
+
+unsigned raw_stream_bytes_consumed(void)
+{
+	return consumer_pos;
+}
+
+unsigned raw_stream_bytes_captured(void)
+{
+	return get_producer_pos();
+}
@@ -0,0 +1,49 @@
+#ifndef RAW_STREAM_H
+
+// Raw multi-revolution captures ("raw reads") for analysing unknown sector
+// formats. clocked_read.pio output goes through a DMA ring straight to the
+// frontend instead of through capture buffers, so the capture length isn't
+// bounded by RAM, only by whether USB keeps up. It usually doesn't quite
+// (READ_DATA is ~1.2MB/s), so the ring absorbs the difference for a few
+// revolutions; if the consumer falls a whole ring behind, the stream is cut
+// short and flagged as overflowed. The ring is capture buffer memory (see
+// lend_buffer_memory() in clocked_read.h), so raw reads need the capture
+// buffers to be empty.
+//
+// The producer (a core1 job) starts the stream, inserts INDEX markers, and
+// stops it. The consumer (core0 data transfers) peeks/consumes bytes and pops
+// INDEX markers.
+
+#include <stdint.h>
+#include "hardware/pio.h"
+
+#define RAW_STREAM_RING_SIZE_BITS  (15) // DMA ring wrap supports up to 1<<15
+#define RAW_STREAM_RING_SIZE       (1 << RAW_STREAM_RING_SIZE_BITS)
+#define RAW_STREAM_MAX_INDEX_MARKS (32)
+
+void raw_stream_init(PIO pio, uint dma_channel);
+
+// producer
+void raw_stream_start(unsigned n_32bit_words);
+int raw_stream_is_capturing(void);
+void raw_stream_mark_index(void);
+void raw_stream_stop(void);
+int raw_stream_has_overflowed(void);
+
+// consumer
+int raw_stream_is_active(void); // started and not yet fully consumed
+// returns number of contiguous bytes available at `*data`; returns 0 and sets
+// overflow if the producer has lapped the consumer
+unsigned raw_stream_peek(const uint8_t** data);
+// returns 0 if the consumed bytes were overwritten while being used (overflow)
+int raw_stream_consume(unsigned n);
+// INDEX markers are byte offsets into the stream (32-bit word granularity)
+int raw_stream_pop_index(unsigned* byte_offset);
+// returns 1 when the producer has stopped and all bytes have been consumed
+int raw_stream_is_done(void);
+void raw_stream_end(void);
+unsigned raw_stream_bytes_consumed(void);
+unsigned raw_stream_bytes_captured(void);
+
+#define RAW_STREAM_H
+#endif
@@ -0,0 +1,62 @@
+#include <string.h>
+
+#include "seek_profile.h"
+#include "base.h"
+
+static struct seek_profile_entry entries[SEEK_PROFILE_N_BANDS][SEEK_N_DIRECTIONS];
+
+void seek_profile_reset(void)
+{
+	memset(entries, 0, sizeof entries);
+}
+
+unsigned seek_profile_get_band(unsigned distance)
+{
+	if (distance == 0) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	const unsigned band = 31 - __builtin_clz(distance);
+	// a seek past the last cylinder (which the drive should refuse) isn't
+	// worth halting for
+	return band < SEEK_PROFILE_N_BANDS ? band : SEEK_PROFILE_N_BANDS-1;
+}
+
+unsigned seek_profile_get_band_first_distance(unsigned band)
+{
+	return 1 << band;
+}
+
+static struct seek_profile_entry* get_entry(unsigned from, unsigned to)
+{
+	if (from == to) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	const enum seek_direction direction = to > from ? SEEK_DIRECTION_FORWARD : SEEK_DIRECTION_REVERSE;
+	return &entries[seek_profile_get_band(to > from ? to - from : from - to)][direction];
+}
+
+static void add_timing(struct seek_timing* t, uint32_t us)
+{
+	if (t->n == 0 || us < t->min_us) t->min_us = us;
+	if (us > t->max_us) t->max_us = us;
+	t->sum_us += us;
+	t->n++;
+}
+
+void seek_profile_add(unsigned from, unsigned to, int response_us, uint32_t seek_us)
+{
+	struct seek_profile_entry* e = get_entry(from, to);
+	if (response_us >= 0) {
+		add_timing(&e->response, response_us);
+	} else {
+		e->n_unseen_responses++;
+	}
+	add_timing(&e->seek, seek_us);
+}
+
+void seek_profile_add_error(unsigned from, unsigned to)
+{
+	get_entry(from, to)->n_errors++;
+}
+
+const struct seek_profile_entry* seek_profile_get_entry(unsigned band, enum seek_direction direction)
+{
+	if (band >= SEEK_PROFILE_N_BANDS || direction >= SEEK_N_DIRECTIONS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	return &entries[band][direction];
+}
@@ -0,0 +1,47 @@
+#ifndef SEEK_PROFILE_H
+
+// Seek timing per seek (TAG1 with a new cylinder), bucketed by distance band
+// (band b holds distances [2^b;2^(b+1)), and the last band anything longer)
+// and direction:
+//  - response: TAG1 to ON CYLINDER going low (the drive starting to move);
+//    only watched during select_cylinder()'s fixed sleep, so seeks where it's
+//    not seen within SEEK_PROFILE_RESPONSE_WINDOW_US are counted separately
+//  - seek: TAG1 to ON CYLINDER and SEEK END (the drive's SEEK END is ON
+//    CYLINDER or SEEK ERROR, so there's no separate settle time to see)
+// Failed seeks (SEEK ERROR, timeout) are only counted.
+
+#include <stdint.h>
+
+#define SEEK_PROFILE_N_BANDS            (10) // 2^10 > DRIVE_CYLINDER_COUNT
+#define SEEK_PROFILE_RESPONSE_WINDOW_US (1000)
+
+enum seek_direction {
+	SEEK_DIRECTION_FORWARD = 0, // towards higher cylinders (the spindle)
+	SEEK_DIRECTION_REVERSE = 1,
+	SEEK_N_DIRECTIONS
+};
+
+struct seek_timing {
+	uint32_t n;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint64_t sum_us;
+};
+
+struct seek_profile_entry {
+	uint32_t n_errors;
+	uint32_t n_unseen_responses; // seeks where ON CYLINDER didn't drop in the window
+	struct seek_timing response;
+	struct seek_timing seek;
+};
+
+void seek_profile_reset(void);
+unsigned seek_profile_get_band(unsigned distance);
+unsigned seek_profile_get_band_first_distance(unsigned band);
+// `response_us` is negative if ON CYLINDER wasn't seen dropping
+void seek_profile_add(unsigned from, unsigned to, int response_us, uint32_t seek_us);
+void seek_profile_add_error(unsigned from, unsigned to);
+const struct seek_profile_entry* seek_profile_get_entry(unsigned band, enum seek_direction direction);
+
+#define SEEK_PROFILE_H
+#endif
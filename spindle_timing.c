@@ -0,0 +1,87 @@
+#include <string.h>
+
+#include "hardware/pwm.h"
+
+#include "spindle_timing.h"
+#include "index_period.pio.h"
+#include "pin_config.h"
+#include "base.h"
+
+// index_period.pio: 2 cycles per count, plus the cycles that aren't counted
+// (leaving the high loop, the edge, the push and restarting X)
+#define PERIOD_CYCLES(COUNT) (2*(COUNT) + 6)
+
+static PIO pio;
+static uint sm;
+static uint sector_slice;
+static uint16_t sector_count0;
+static uint32_t window_start_us;
+static int is_first_period;
+static struct spindle_timing window;
+
+void spindle_timing_init(PIO _pio)
+{
+	pio = _pio;
+	const uint offset = pio_add_program(pio, &index_period_program);
+	sm = pio_claim_unused_sm(pio, true);
+	pio_sm_config cfg = index_period_program_get_default_config(offset);
+	sm_config_set_jmp_pin(&cfg, GPIO_INDEX);
+	sm_config_set_fifo_join(&cfg, PIO_FIFO_JOIN_RX); // 8 revolutions of slack
+	pio_sm_init(pio, sm, offset, &cfg);
+	pio_sm_set_enabled(pio, sm, true);
+	is_first_period = 1;
+
+	_Static_assert((GPIO_SECTOR & 1) == 1, "SECTOR must be on a PWM B pin to be counted");
+	sector_slice = pwm_gpio_to_slice_num(GPIO_SECTOR);
+	pwm_config pcfg = pwm_get_default_config();
+	pwm_config_set_clkdiv_mode(&pcfg, PWM_DIV_B_RISING);
+	pwm_config_set_clkdiv(&pcfg, 1.0f);
+	pwm_init(sector_slice, &pcfg, true);
+	gpio_set_function(GPIO_SECTOR, GPIO_FUNC_PWM); // input is still readable with gpio_get_all()
+
+	sector_count0 = pwm_get_counter(sector_slice);
+	window_start_us = time_us_32();
+}
+
+void spindle_timing_poll(void)
+{
+	const uint32_t rxstall = 1u << (PIO_FDEBUG_RXSTALL_LSB + sm);
+	while (!pio_sm_is_rx_fifo_empty(pio, sm)) {
+		const uint32_t count = pio_sm_get(pio, sm);
+		if (is_first_period) {
+			is_first_period = 0;
+			continue;
+		}
+		const uint32_t cycles = PERIOD_CYCLES(count);
+		if (window.n_periods == 0) {
+			window.first_cycles = cycles;
+			window.min_cycles = cycles;
+			window.max_cycles = cycles;
+		}
+		if (cycles < window.min_cycles) window.min_cycles = cycles;
+		if (cycles > window.max_cycles) window.max_cycles = cycles;
+		const int64_t d = (int64_t)cycles - window.first_cycles;
+		window.sum_sq_deviation += d*d;
+		window.sum_cycles += cycles;
+		window.n_periods++;
+	}
+	// a "push noblock" into a full FIFO is dropped; the next period is
+	// still whole, only the lost one is missing
+	if (pio->fdebug & rxstall) {
+		pio->fdebug = rxstall;
+		window.n_dropped++;
+	}
+}
+
+void spindle_timing_take(struct spindle_timing* t)
+{
+	spindle_timing_poll();
+	const uint32_t now = time_us_32();
+	const uint16_t sector_count = pwm_get_counter(sector_slice);
+	window.window_us = now - window_start_us;
+	window.n_sector_edges = (uint16_t)(sector_count - sector_count0);
+	*t = window;
+	memset(&window, 0, sizeof window);
+	window_start_us = now;
+	sector_count0 = sector_count;
+}
@@ -0,0 +1,30 @@
+#ifndef SPINDLE_TIMING_H
+
+// Spindle speed measured in hardware, so edges aren't missed however busy
+// core0 is: index_period.pio times every INDEX period in system clock cycles,
+// and a PWM slice counts SECTOR rising edges (SECTOR must be a PWM "B" pin).
+// Core0 drains the periods with spindle_timing_poll(), and takes the
+// statistics for a window (e.g. a status tick) with spindle_timing_take().
+
+#include <stdint.h>
+#include "hardware/pio.h"
+
+struct spindle_timing {
+	uint32_t window_us;
+	uint32_t n_sector_edges;
+	uint32_t n_periods;        // complete INDEX periods (revolutions)
+	uint32_t n_dropped;        // periods lost to a full RX FIFO
+	uint64_t sum_cycles;
+	uint32_t min_cycles;
+	uint32_t max_cycles;
+	int64_t sum_sq_deviation;  // squared deviations from the first period, for stddev
+	uint32_t first_cycles;
+};
+
+void spindle_timing_init(PIO pio);
+void spindle_timing_poll(void);
+// statistics since the last take (periods are polled first)
+void spindle_timing_take(struct spindle_timing*);
+
+#define SPINDLE_TIMING_H
+#endif
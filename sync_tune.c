@@ -0,0 +1,82 @@
+#include <string.h>
+
+#include "sync_tune.h"
+#include "base.h"
+
+static struct sync_histogram histograms[DRIVE_HEAD_COUNT][SYNC_TUNE_N_ZONES][SYNC_N_FIELDS];
+
+void sync_tune_reset(void)
+{
+	memset(histograms, 0, sizeof histograms);
+}
+
+unsigned sync_tune_get_zone(unsigned cylinder)
+{
+	if (cylinder >= DRIVE_CYLINDER_COUNT) return SYNC_TUNE_N_ZONES-1;
+	return (cylinder * SYNC_TUNE_N_ZONES) / DRIVE_CYLINDER_COUNT;
+}
+
+unsigned sync_tune_get_origin(enum sync_field field)
+{
+	return field == SYNC_FIELD_ADDRESS ? SYNC_TUNE_ADDRESS_ORIGIN : SYNC_TUNE_DATA_ORIGIN;
+}
+
+static struct sync_histogram* get_histogram(unsigned head, unsigned zone, enum sync_field field)
+{
+	if (head >= DRIVE_HEAD_COUNT || zone >= SYNC_TUNE_N_ZONES || field >= SYNC_N_FIELDS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	return &histograms[head][zone][field];
+}
+
+void sync_tune_add(unsigned head, unsigned cylinder, enum sync_field field, unsigned offset)
+{
+	if (cylinder >= DRIVE_CYLINDER_COUNT) return; // not a zone's sample
+	struct sync_histogram* h = get_histogram(head, sync_tune_get_zone(cylinder), field);
+	const unsigned origin = sync_tune_get_origin(field);
+	unsigned bin = offset < origin ? 0 : (offset - origin) / SYNC_TUNE_BIN_WIDTH;
+	if (bin >= SYNC_TUNE_N_BINS) bin = SYNC_TUNE_N_BINS-1;
+	if (h->counts[bin] == 0xffff) {
+		// keep the shape; also lets old samples fade out
+		h->n_samples = 0;
+		for (int i = 0; i < SYNC_TUNE_N_BINS; i++) {
+			h->counts[i] >>= 1;
+			h->n_samples += h->counts[i];
+		}
+	}
+	h->counts[bin]++;
+	h->n_samples++;
+}
+
+const struct sync_histogram* sync_tune_get_histogram(unsigned head, unsigned zone, enum sync_field field)
+{
+	return get_histogram(head, zone, field);
+}
+
+unsigned sync_tune_get_zone_wait(unsigned head, unsigned zone, enum sync_field field)
+{
+	const struct sync_histogram* h = get_histogram(head, zone, field);
+	if (h->n_samples < SYNC_TUNE_MIN_SAMPLES) return 0;
+
+	// lower edge of the bin holding the SYNC_TUNE_PERCENTILE'th percentile;
+	// the first bin also holds everything earlier, so it's taken as is
+	const uint32_t n_skip = (h->n_samples * SYNC_TUNE_PERCENTILE) / 100;
+	uint32_t n = 0;
+	int bin = 0;
+	for (; bin < SYNC_TUNE_N_BINS-1; bin++) {
+		n += h->counts[bin];
+		if (n > n_skip) break;
+	}
+	const int earliest = sync_tune_get_origin(field) + bin*SYNC_TUNE_BIN_WIDTH;
+
+	const int min_wait = field == SYNC_FIELD_DATA ? SYNC_TUNE_MIN_GAP_B_WAIT : 1;
+	const int wait = earliest - SYNC_TUNE_PLO_BITS - SYNC_TUNE_MARGIN_BITS;
+	return wait < min_wait ? min_wait : wait;
+}
+
+void sync_tune_get_waits(unsigned head, unsigned cylinder, unsigned* gap_a_wait, unsigned* gap_b_wait)
+{
+	const unsigned zone = sync_tune_get_zone(cylinder);
+	const unsigned a = sync_tune_get_zone_wait(head, zone, SYNC_FIELD_ADDRESS);
+	const unsigned b = sync_tune_get_zone_wait(head, zone, SYNC_FIELD_DATA);
+	if (a > 0) *gap_a_wait = a;
+	if (b > 0) *gap_b_wait = b;
+}
@@ -0,0 +1,54 @@
+#ifndef SYNC_TUNE_H
+
+// Histograms of where address and data SYNC actually are (as measured by
+// sync_timer.pio; see cr8044read_get_sync_offsets()), per head and cylinder
+// zone, and the gap waits derived from them: read gate is opened as late as
+// possible while still leaving the drive SYNC_TUNE_PLO_BITS zero bits (plus
+// a margin) before all but the earliest SYNC_TUNE_PERCENTILE% of SYNCs. A
+// late read gate leaves less gap for noise to fake a SYNC in.
+//
+// Offsets are in bits: address SYNC from the SECTOR pulse, data SYNC from the
+// end of the address field. Bins are SYNC_TUNE_BIN_WIDTH bits wide starting
+// at a per-field origin; offsets outside the range land in the end bins.
+
+#include <stdint.h>
+
+#include "drive.h"
+
+#define SYNC_TUNE_N_ZONES      (4)   // cylinder zones per head
+#define SYNC_TUNE_N_BINS       (64)
+#define SYNC_TUNE_BIN_WIDTH    (4)
+#define SYNC_TUNE_ADDRESS_ORIGIN (64)
+#define SYNC_TUNE_DATA_ORIGIN  (0)
+#define SYNC_TUNE_PLO_BITS     (75)  // zeroes the drive needs after read gate on (7.75µs)
+#define SYNC_TUNE_MARGIN_BITS  (8)
+#define SYNC_TUNE_MIN_GAP_B_WAIT (30) // the "inversion point"; see cr8044read.h
+#define SYNC_TUNE_PERCENTILE   (1)
+#define SYNC_TUNE_MIN_SAMPLES  (64)  // per histogram, before it's trusted
+
+enum sync_field {
+	SYNC_FIELD_ADDRESS = 0,
+	SYNC_FIELD_DATA    = 1,
+	SYNC_N_FIELDS
+};
+
+struct sync_histogram {
+	uint32_t n_samples;
+	uint16_t counts[SYNC_TUNE_N_BINS]; // halved when one would overflow
+};
+
+void sync_tune_reset(void);
+// cylinders past the last one are in the last zone
+unsigned sync_tune_get_zone(unsigned cylinder);
+unsigned sync_tune_get_origin(enum sync_field field);
+// drops samples from cylinders past the last one
+void sync_tune_add(unsigned head, unsigned cylinder, enum sync_field field, unsigned offset);
+const struct sync_histogram* sync_tune_get_histogram(unsigned head, unsigned zone, enum sync_field field);
+// returns the tuned wait for a zone, or 0 if it doesn't have enough samples
+unsigned sync_tune_get_zone_wait(unsigned head, unsigned zone, enum sync_field field);
+// tuned gap waits for a track; keeps `*gap_a_wait`/`*gap_b_wait` (e.g. the
+// layout's) where there aren't enough samples
+void sync_tune_get_waits(unsigned head, unsigned cylinder, unsigned* gap_a_wait, unsigned* gap_b_wait);
+
+#define SYNC_TUNE_H
+#endif
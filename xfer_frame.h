@@ -0,0 +1,70 @@
+#ifndef XFER_FRAME_H
+
+// Binary data transfer frames. When the frontend has enabled binary transfers
+// (see COMMAND set_transfer_mode) the "F1" base64 lines between the "F0"
+// header and the "F2" footer are replaced by frames written directly to the
+// CDC endpoint:
+//   byte 0      XFER_FRAME_MAGIC
+//   byte 1-2    payload length (little endian)
+//   byte 3-4    sequence number (little endian; wraps at 1<<16)
+//   byte 5-8    adler32 of payload (little endian)
+//   byte 9-     payload
+// XFER_FRAME_MAGIC is not ASCII, so a receiver can tell a frame apart from a
+// text line by looking at the first byte of a line.
+
+#include <stdint.h>
+
+#include "adler32.h"
+
+#define XFER_FRAME_MAGIC        (0xFB)
+#define XFER_FRAME_HEADER_SIZE  (9)
+#define XFER_FRAME_MAX_PAYLOAD  (1<<12)
+
+struct xfer_frame_header {
+	unsigned length;
+	unsigned sequence;
+	uint32_t checksum;
+};
+
+static inline void xfer_frame__put_u16(uint8_t* p, unsigned v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static inline unsigned xfer_frame__get_u16(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+// writes header for an `n` byte payload with adler32 `checksum` to `dst`;
+// returns pointer to where the payload should go
+static inline uint8_t* xfer_frame_encode_header_checksum(uint8_t* dst, unsigned sequence, unsigned n, uint32_t checksum)
+{
+	dst[0] = XFER_FRAME_MAGIC;
+	xfer_frame__put_u16(dst+1, n);
+	xfer_frame__put_u16(dst+3, sequence & 0xffff);
+	xfer_frame__put_u16(dst+5, checksum & 0xffff);
+	xfer_frame__put_u16(dst+7, checksum >> 16);
+	return dst + XFER_FRAME_HEADER_SIZE;
+}
+
+// writes header for `payload` to `dst`; returns pointer to where the payload
+// should go (it isn't copied)
+static inline uint8_t* xfer_frame_encode_header(uint8_t* dst, unsigned sequence, const uint8_t* payload, unsigned n)
+{
+	return xfer_frame_encode_header_checksum(dst, sequence, n, adler32(payload, n));
+}
+
+// returns 0 if `src` doesn't look like a frame header
+static inline int xfer_frame_decode_header(const uint8_t* src, struct xfer_frame_header* header)
+{
+	if (src[0] != XFER_FRAME_MAGIC) return 0;
+	header->length = xfer_frame__get_u16(src+1);
+	header->sequence = xfer_frame__get_u16(src+3);
+	header->checksum = xfer_frame__get_u16(src+5) | ((uint32_t)xfer_frame__get_u16(src+7) << 16);
+	return header->length <= XFER_FRAME_MAX_PAYLOAD;
+}
+
+#define XFER_FRAME_H
+#endif
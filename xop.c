@@ -1,5 +1,7 @@
-// DESIGN NOTE: The "drive operations code" in here is executed on core1. It's
-// slightly wasteful because operations busy wait most of the time. One
+// DESIGN NOTE: The "drive operations code" in here is executed on core1.
+// Operations mostly wait: cr8044read captures sleep until the DMA interrupt,
+// and status pin waits until an edge interrupt (taken by core0; see
+// pin_events.h and xop_batch_stats.idle_us). One
 // reedeming quality with this design is that core0 operations can't delay
 // drive operations, but frankly I chose this design because it's easier to
 // write than various ways of doing async code in C. Also, I really don't have
@@ -7,7 +9,12 @@
 // entirely handled by PIO/DMA)
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "pico/multicore.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
 
 #include "base.h"
 #include "pin_config.h"
@@ -16,6 +23,10 @@
 #include "xop.h"
 #include "clocked_read.h"
 #include "cr8044read.h"
+#include "raw_stream.h"
+#include "sync_tune.h"
+#include "seek_profile.h"
+#include "pin_events.h"
 
 #define ERROR_MASK                \
 	( (1 << GPIO_FAULT)       \
@@ -27,16 +38,39 @@
 	| (1 << GPIO_UNIT_SELECTED)  \
 	)
 
-#define TAG_STROBE_SLEEP() sleep_us(2)
 // I haven't seen anything in the docs about how long a "tag pin" should be
 // held high before the drive registers the signal. For specific
-// operations/pins I'm seeing quotes of 250 ns to 1.0 µs, so 2.0 µs should be
-// abundant?
+// operations/pins I'm seeing quotes of 250 ns to 1.0 µs. The defaults are
+// generous; xop_calibrate_tag_timing() finds out what the drive needs.
+static const struct xop_tag_timing tag_timing_default = {
+	.setup_ns = TAG_TIMING_DEFAULT_NS,
+	.hold_ns  = TAG_TIMING_DEFAULT_NS,
+};
+static struct xop_tag_timing tag_timing_profile = {
+	.setup_ns = TAG_TIMING_DEFAULT_NS,
+	.hold_ns  = TAG_TIMING_DEFAULT_NS,
+};
+// the timing in use by this job (converted from the profile by BEGIN()), in
+// system clock cycles
+static uint32_t tag_setup_cycles;
+static uint32_t tag_hold_cycles;
+// switch_head_and_enable_read() has to fit in a Gap-C, so it caps both
+#define TAG_SWITCH_MAX_NS (2000)
+static uint32_t tag_switch_setup_cycles;
+static uint32_t tag_switch_hold_cycles;
+
+// off while seeks aren't trusted to go where they're sent (tag timing
+// calibration); see seek_profile.h
+static int is_seek_profiling = 1;
 
 absolute_time_t job_begin_time_us;
 absolute_time_t job_duration_us;
 volatile enum xop_status status;
 unsigned current_cylinder_according_to_the_controller;
+struct xop_batch_stats batch_stats;
+// index of the adjustment being read by job_batch_read() (0 if pipelined or
+// adaptive), for the track buffers' batch positions; -1 outside batch reads
+static int batch_adjustment = -1;
 
 static void unit0_select_tag(void)
 {
@@ -59,15 +93,33 @@ static void clear_output(void)
 	set_bits(0);
 }
 
-#define TAG_SLEEP_US (10)
+static void set_tag_timing(const struct xop_tag_timing* t)
+{
+	const uint32_t cycles_per_us = clock_get_hz(clk_sys) / 1000000;
+	tag_setup_cycles = (t->setup_ns * cycles_per_us + 999) / 1000;
+	tag_hold_cycles  = (t->hold_ns  * cycles_per_us + 999) / 1000;
+	const uint32_t max_cycles = (TAG_SWITCH_MAX_NS * cycles_per_us) / 1000;
+	tag_switch_setup_cycles = tag_setup_cycles < max_cycles ? tag_setup_cycles : max_cycles;
+	tag_switch_hold_cycles  = tag_hold_cycles  < max_cycles ? tag_hold_cycles  : max_cycles;
+}
+
+static inline void tag_setup_sleep(void)
+{
+	busy_wait_at_least_cycles(tag_setup_cycles);
+}
+
+static inline void tag_hold_sleep(void)
+{
+	busy_wait_at_least_cycles(tag_hold_cycles);
+}
 
 static void tag1_cylinder(unsigned cylinder)
 {
 	clear_output();
 	set_bits(cylinder);
-	sleep_us(TAG_SLEEP_US);
+	tag_setup_sleep();
 	gpio_put(GPIO_TAG1, 1);
-	sleep_us(TAG_SLEEP_US);
+	tag_hold_sleep();
 	clear_output();
 	// NOTE: does not set current_cylinder_according_to_the_controller
 }
@@ -76,8 +128,9 @@ static void tag2_head(unsigned head)
 {
 	clear_output();
 	set_bits(head);
+	tag_setup_sleep();
 	gpio_put(GPIO_TAG2, 1);
-	sleep_us(TAG_SLEEP_US);
+	tag_hold_sleep();
 	clear_output();
 }
 
@@ -85,20 +138,24 @@ static void tag3_ctrl(unsigned ctrl)
 {
 	clear_output();
 	set_bits(ctrl);
-	sleep_us(TAG_SLEEP_US);
+	tag_setup_sleep();
 	gpio_put(GPIO_TAG3, 1);
 }
 
 static void tag3_ctrl_strobe(unsigned ctrl)
 {
 	tag3_ctrl(ctrl);
-	sleep_us(TAG_SLEEP_US);
+	tag_hold_sleep();
 	clear_output();
 }
 
 static void BEGIN(void)
 {
 	job_begin_time_us = get_absolute_time();
+	batch_adjustment = -1;
+	pin_events_init_waiter();
+	set_tag_timing(&tag_timing_profile);
+	is_seek_profiling = 1;
 }
 
 __attribute__ ((noreturn))
@@ -122,24 +179,50 @@ static void ERROR(enum xop_status error_code)
 	job_halt();
 }
 
-static void check_drive_error(void)
+static enum xop_status get_drive_error(void)
 {
 	unsigned pins = gpio_get_all();
-	if ((pins & ERROR_MASK) != 0)          ERROR(XST_ERR_DRIVE_ERROR);
-	if ((pins & READY_MASK) != READY_MASK) ERROR(XST_ERR_DRIVE_NOT_READY);
+	if ((pins & ERROR_MASK) != 0)          return XST_ERR_DRIVE_ERROR;
+	if ((pins & READY_MASK) != READY_MASK) return XST_ERR_DRIVE_NOT_READY;
+	return XST_DONE;
 }
 
-static void pin_mask_wait(unsigned mask, unsigned value, unsigned timeout_us, int check_error)
+static void check_drive_error(void)
+{
+	const enum xop_status e = get_drive_error();
+	if (e != XST_DONE) ERROR(e);
+}
+
+// like pin_mask_wait(), but returns the error (or XST_DONE) instead of
+// failing the job
+static enum xop_status pin_mask_try_wait(unsigned mask, unsigned value, unsigned timeout_us, int check_error)
 {
 	const absolute_time_t t0 = get_absolute_time();
-	while (1) {
-		if (check_error) check_drive_error();
-		if ((gpio_get_all() & mask) == value) break;
-		if ((get_absolute_time() - t0) > timeout_us) {
-			ERROR(XST_ERR_TIMEOUT);
+	const absolute_time_t deadline = t0 + timeout_us;
+	const uint32_t watch = mask | (check_error ? (ERROR_MASK | READY_MASK) : 0);
+	pin_events_watch(watch);
+	enum xop_status e;
+	for (;;) {
+		if (check_error && (e = get_drive_error()) != XST_DONE) break;
+		if ((gpio_get_all() & mask) == value) {
+			e = XST_DONE;
+			break;
 		}
-		sleep_us(1);
+		if (time_reached(deadline)) {
+			e = XST_ERR_TIMEOUT;
+			break;
+		}
+		pin_events_sleep_until(deadline);
 	}
+	pin_events_unwatch(watch);
+	batch_stats.idle_us += get_absolute_time() - t0;
+	return e;
+}
+
+static void pin_mask_wait(unsigned mask, unsigned value, unsigned timeout_us, int check_error)
+{
+	const enum xop_status e = pin_mask_try_wait(mask, value, timeout_us, check_error);
+	if (e != XST_DONE) ERROR(e);
 }
 
 static void pin_wait(unsigned gpio, unsigned value, unsigned timeout_us, int check_error)
@@ -200,20 +283,53 @@ static unsigned get_read_adjustment_bits(int servo_offset, int data_strobe_delay
 	return ctrl;
 }
 
-static void select_cylinder(unsigned cylinder)
+// timing of the last try_select_cylinder()
+static struct {
+	int response_us; // -1 if not seen
+	uint32_t seek_us;
+} last_seek;
+
+// select_cylinder() that returns the error (or XST_DONE) instead of failing
+// the job; the drive is left as is (e.g. with SEEK_ERROR set)
+static enum xop_status try_select_cylinder(unsigned cylinder)
 {
+	const unsigned from = current_cylinder_according_to_the_controller;
+	const volatile struct pin_edges* on_cylinder = pin_events_get_edges(GPIO_ON_CYLINDER);
+	pin_events_watch(1 << GPIO_ON_CYLINDER);
+	const uint32_t n_falling0 = on_cylinder->n_falling;
+	const uint32_t t0 = time_us_32();
 	tag1_cylinder(cylinder);
 	// Assuming it might take a little while before ON_CYLINDER and
-	// SEEK_END go low?
-	sleep_us(1000);
+	// SEEK_END go low? (the sleep doubles as the window in which the
+	// response time is seen; see seek_profile.h)
+	const absolute_time_t window_end = get_absolute_time() + SEEK_PROFILE_RESPONSE_WINDOW_US - (time_us_32() - t0);
+	while (!time_reached(window_end)) pin_events_sleep_until(window_end);
+	const int response_us = on_cylinder->n_falling != n_falling0 ? (int)(on_cylinder->falling_us - t0) : -1;
+	pin_events_unwatch(1 << GPIO_ON_CYLINDER);
 	// NOTE: the drive should signal SEEK_ERROR (which IS caught by
 	// pin_mask_wait()) if the seek does not complete within 500ms
 	const unsigned bits = (1<<GPIO_ON_CYLINDER) | (1<<GPIO_SEEK_END);
 	// NOTE: drive doc says that "Seek End is a combination of ON CYL or
 	// SEEK ERROR" suggesting it's a simple OR-gate of those signals. But
 	// it's a good sanity check nevertheless (cable/drive may be broken).
-	pin_mask_wait(bits, bits, 1000000, 1);
-	current_cylinder_according_to_the_controller = cylinder;
+	const enum xop_status e = pin_mask_try_wait(bits, bits, 1000000, 1);
+	last_seek.response_us = response_us;
+	last_seek.seek_us = time_us_32() - t0;
+	if (cylinder != from && is_seek_profiling) {
+		if (e == XST_DONE) {
+			seek_profile_add(from, cylinder, response_us, last_seek.seek_us);
+		} else {
+			seek_profile_add_error(from, cylinder);
+		}
+	}
+	if (e == XST_DONE) current_cylinder_according_to_the_controller = cylinder;
+	return e;
+}
+
+static void select_cylinder(unsigned cylinder)
+{
+	const enum xop_status e = try_select_cylinder(cylinder);
+	if (e != XST_DONE) ERROR(e);
 }
 
 // seek in single-cylinder steps; the drive divides seeking into two phases:
@@ -236,42 +352,163 @@ static void broken_seek(unsigned cylinder)
 	}
 }
 
+// SEEK_MODE_HYBRID remembers, per seek distance band (as in seek_profile.h),
+// whether direct seeks work on this drive. a band that has
+// failed steps instead, but tries a direct seek again after a while (backing
+// off with repeated failures) in case the failure was a fluke.
+#define SEEK_BAND_REPROBE      (16) // stepped seeks before retrying a direct seek
+#define SEEK_BAND_MAX_BACKOFF  (4)  // doublings of SEEK_BAND_REPROBE
+static struct seek_band {
+	uint8_t n_failed;  // consecutive direct seek failures
+	uint16_t n_stepped; // stepped seeks since the last failure
+} seek_bands[SEEK_PROFILE_N_BANDS];
+
+static struct seek_band* get_seek_band(unsigned distance)
+{
+	return &seek_bands[seek_profile_get_band(distance)];
+}
+
+static int seek_band_prefers_stepping(const struct seek_band* band)
+{
+	if (band->n_failed == 0) return 0;
+	const unsigned backoff = band->n_failed-1 < SEEK_BAND_MAX_BACKOFF ? band->n_failed-1 : SEEK_BAND_MAX_BACKOFF;
+	return band->n_stepped < (SEEK_BAND_REPROBE << backoff);
+}
+
+static uint32_t estimate_seek_us(unsigned from, unsigned to, enum seek_mode mode)
+{
+	const unsigned d = from > to ? from - to : to - from;
+	if (d == 0) return 0;
+	if (mode == SEEK_MODE_HYBRID && seek_band_prefers_stepping(get_seek_band(d))) mode = SEEK_MODE_SINGLE_STEP;
+	if (mode == SEEK_MODE_SINGLE_STEP) return d * DRIVE_SEEK_MIN_US;
+	// seek time grows roughly with the square root of the distance
+	// (accelerate, then decelerate)
+	const float x = sqrtf((float)(d-1) / (float)(DRIVE_CYLINDER_COUNT-2));
+	return DRIVE_SEEK_MIN_US + (uint32_t)(x * (DRIVE_SEEK_MAX_US - DRIVE_SEEK_MIN_US));
+}
+
+// direct seek, falling back to broken_seek() when it fails with SEEK_ERROR
+// (or times out): the fault is cleared and the heads are returned to
+// cylinder 0 (so we know where they are) before trying again. only DRIVE
+// NOT READY, or failing to step, fails the job.
+static void hybrid_seek(unsigned cylinder)
+{
+	for (int attempt = 0;; attempt++) {
+		const unsigned from = current_cylinder_according_to_the_controller;
+		if (cylinder == from) return;
+		struct seek_band* band = get_seek_band(from > cylinder ? from - cylinder : cylinder - from);
+		// at most two direct seeks (the second from cylinder 0)
+		if (attempt >= 2 || seek_band_prefers_stepping(band)) {
+			if (band->n_stepped < 0xffff) band->n_stepped++;
+			batch_stats.n_stepped_seeks++;
+			broken_seek(cylinder);
+			return;
+		}
+
+		const enum xop_status e = try_select_cylinder(cylinder);
+		if (e == XST_DONE) {
+			band->n_failed = 0;
+			return;
+		}
+		if (e != XST_ERR_DRIVE_ERROR && e != XST_ERR_TIMEOUT) ERROR(e);
+
+		if (band->n_failed < 0xff) band->n_failed++;
+		band->n_stepped = 0;
+		batch_stats.n_seek_fallbacks++;
+		return_to_normal();
+		const unsigned bits = (1<<GPIO_ON_CYLINDER) | (1<<GPIO_SEEK_END);
+		pin_mask_wait(bits, bits, 1000000, 1);
+	}
+}
+
+// select_cylinder(), broken_seek() or hybrid_seek(), counted in batch_stats
+static void seek(unsigned cylinder, enum seek_mode mode)
+{
+	const unsigned from = current_cylinder_according_to_the_controller;
+	const absolute_time_t t0 = get_absolute_time();
+	// estimated up front; hybrid_seek() updates the bands
+	batch_stats.estimated_seek_us += estimate_seek_us(from, cylinder, mode);
+	if (mode == SEEK_MODE_SINGLE_STEP) {
+		broken_seek(cylinder);
+	} else if (mode == SEEK_MODE_HYBRID) {
+		hybrid_seek(cylinder);
+	} else {
+		select_cylinder(cylinder);
+	}
+	batch_stats.n_seeks++;
+	batch_stats.seek_cylinders += from > cylinder ? from - cylinder : cylinder - from;
+	batch_stats.seek_us += get_absolute_time() - t0;
+}
+
 static void select_head(unsigned head)
 {
 	check_drive_error();
 	tag2_head(head);
 }
 
-static inline void wait_for_index(int skip_checks)
+// select_head() followed by read enable (TAG3 with `ctrl` bits) with the tag
+// timing capped at TAG_SWITCH_MAX_NS; used when switching heads between
+// back-to-back captures, where there's only the last sector's Gap-C (~15µs)
+// before the next INDEX
+static void switch_head_and_enable_read(unsigned head, unsigned ctrl)
 {
-	//pin_wait_for_zero(GPIO_INDEX, FREQ_IN_MICROS(DRIVE_RPS)/10, !skip_checks);
-	//pin_wait_for_one(GPIO_INDEX, FREQ_IN_MICROS(DRIVE_RPS/3), !skip_checks); // wait at most 3 revolutions
-	pin_wait_for_zero(GPIO_INDEX, 1000000, !skip_checks);
-	pin_wait_for_one(GPIO_INDEX,  1000000, !skip_checks);
+	check_drive_error();
+	clear_output();
+	set_bits(head);
+	busy_wait_at_least_cycles(tag_switch_setup_cycles);
+	gpio_put(GPIO_TAG2, 1);
+	busy_wait_at_least_cycles(tag_switch_hold_cycles);
+	gpio_put(GPIO_TAG2, 0);
+	set_bits(ctrl);
+	busy_wait_at_least_cycles(tag_switch_setup_cycles);
+	gpio_put(GPIO_TAG3, 1);
 }
 
-static inline void wait_for_sector(void)
+// waits for the next rising edge on `gpio` (counted by the edge interrupt,
+// so even a pulse shorter than a wakeup isn't missed); returns its
+// time_us_32() timestamp
+static uint32_t pin_wait_for_rising_edge(unsigned gpio, unsigned timeout_us, int check_error)
 {
-	const int mask = (1 << GPIO_SECTOR);
-	{
-		int match_count = 0;
-		const int debounce_count = 5;
-		while (match_count < debounce_count) {
-			const int is_zero = (gpio_get_all() & mask) == 0;
-			if (is_zero) {
-				match_count++;
-			} else {
-				match_count = 0;
-			}
+	const absolute_time_t t0 = get_absolute_time();
+	const absolute_time_t deadline = t0 + timeout_us;
+	const uint32_t watch = (1 << gpio) | (check_error ? (ERROR_MASK | READY_MASK) : 0);
+	pin_events_watch(watch);
+	const volatile struct pin_edges* edges = pin_events_get_edges(gpio);
+	const uint32_t n0 = edges->n_rising;
+	enum xop_status e;
+	for (;;) {
+		if (check_error && (e = get_drive_error()) != XST_DONE) break;
+		if (edges->n_rising != n0) {
+			e = XST_DONE;
+			break;
+		}
+		if (time_reached(deadline)) {
+			e = XST_ERR_TIMEOUT;
+			break;
 		}
+		pin_events_sleep_until(deadline);
 	}
-	// wait for one
-	while ((gpio_get_all() & mask) == 0);
+	pin_events_unwatch(watch);
+	batch_stats.idle_us += get_absolute_time() - t0;
+	if (e != XST_DONE) ERROR(e);
+	return edges->rising_us;
+}
+
+static inline uint32_t wait_for_index(int skip_checks)
+{
+	return pin_wait_for_rising_edge(GPIO_INDEX, 1000000, !skip_checks);
+}
+
+static inline uint32_t wait_for_sector(void)
+{
+	return pin_wait_for_rising_edge(GPIO_SECTOR, 1000000, 0);
 }
 
 static inline void reset(void)
 {
 	multicore_reset_core1(); // waits until core1 is down
+	raw_stream_stop();
+	cr8044read_abort();
 }
 
 static inline void reset_and_kill_output(void)
@@ -282,9 +519,24 @@ static inline void reset_and_kill_output(void)
 }
 
 
+// scratch captures for batch re-reads; good sectors are copied into the
+// track buffer. there are two so that the next re-read can be captured while
+// the previous one is verified. they're allocated from the capture buffer
+// ring when a track first needs a re-read, and discarded once every track
+// buffer allocated before them is written (buffers are written in
+// allocation order)
+static int retry_buffer_index = -1;
+static unsigned n_unwritten_track_buffers;
+
 static void run(void(*fn)(void))
 {
 	status = XST_RUNNING;
+	memset(&batch_stats, 0, sizeof batch_stats);
+	// a job killed by reset() may have left buffers allocated but never
+	// written; core1 is down so it's safe to drop them from here
+	abandon_unwritten_buffers();
+	retry_buffer_index = -1;
+	n_unwritten_track_buffers = 0;
 	multicore_launch_core1(fn);
 }
 
@@ -324,7 +576,6 @@ union {
 		int data_strobe_delay;
 	} read_enable;
 	struct {
-		unsigned buffer_index;
 		unsigned n_32bit_words;
 		unsigned index_sync;
 		unsigned skip_checks;
@@ -336,6 +587,10 @@ union {
 		unsigned head_set;
 		int servo_offset;
 		int data_strobe_delay;
+		unsigned max_retries;
+		unsigned flags;
+		int resume_head;       // -1, or the checkpoint's head on cylinder0
+		int resume_adjustment;
 	} batch_read;
 
 } job_args;
@@ -440,6 +695,99 @@ void xop_broken_seek(unsigned cylinder)
 	run(job_broken_seek);
 }
 
+
+/////////////////////////////////////////////////////////////////////////////
+// tag timing calibration ///////////////////////////////////////////////////
+// Seeks back and forth between cylinders 255 and 256 (which differ in BIT0-8)
+// with shorter and shorter tag hold times, and then setup times, for as long
+// as every seek is seen starting (ON CYLINDER drops), ends without SEEK ERROR
+// or FAULT, and is as quick as a one-cylinder seek should be. A missed TAG1
+// doesn't seek at all, and a cylinder latched before BIT0-8 settled is
+// (nearly) all zeroes, i.e. a long seek. The shortest times that worked,
+// times TAG_CALIBRATION_MARGIN, become the profile for all tags.
+#define TAG_CALIBRATION_CYLINDER   (255)
+#define TAG_CALIBRATION_N_SEEKS    (8)
+#define TAG_CALIBRATION_MAX_SEEK_US (2*DRIVE_SEEK_MIN_US)
+#define TAG_CALIBRATION_MARGIN     (2)
+static const uint32_t tag_calibration_ns[] = { 5000, 2000, 1000, 750, 500, 375, 250, 125 };
+
+static void tag_calibration_recover(void)
+{
+	set_tag_timing(&tag_timing_default);
+	if (get_drive_error() == XST_ERR_DRIVE_ERROR) {
+		return_to_normal();
+		const unsigned bits = (1<<GPIO_ON_CYLINDER) | (1<<GPIO_SEEK_END);
+		pin_mask_wait(bits, bits, 1000000, 1);
+	}
+	// where the heads went isn't known; make sure
+	select_cylinder(0);
+	select_cylinder(TAG_CALIBRATION_CYLINDER);
+}
+
+static int tag_timing_works(const struct xop_tag_timing* t)
+{
+	set_tag_timing(t);
+	for (int i = 0; i < TAG_CALIBRATION_N_SEEKS; i++) {
+		const unsigned cylinder = TAG_CALIBRATION_CYLINDER + ((i & 1) ? 0 : 1);
+		const enum xop_status e = try_select_cylinder(cylinder);
+		if (e == XST_ERR_DRIVE_NOT_READY) ERROR(e);
+		if (e != XST_DONE || last_seek.response_us < 0 || last_seek.seek_us > TAG_CALIBRATION_MAX_SEEK_US) {
+			tag_calibration_recover();
+			return 0;
+		}
+	}
+	set_tag_timing(&tag_timing_default);
+	return 1;
+}
+
+void job_calibrate_tag_timing(void)
+{
+	BEGIN();
+	check_drive_error();
+	if ((TAG_CALIBRATION_CYLINDER+1) >= DRIVE_CYLINDER_COUNT) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	is_seek_profiling = 0;
+	const struct xop_tag_timing safe = tag_timing_default;
+	set_tag_timing(&safe);
+	select_cylinder(TAG_CALIBRATION_CYLINDER);
+
+	// hold times first, with a safe setup time
+	struct xop_tag_timing best = safe;
+	for (int i = 0; i < ARRAY_LENGTH(tag_calibration_ns); i++) {
+		struct xop_tag_timing t = { .setup_ns = safe.setup_ns, .hold_ns = tag_calibration_ns[i] };
+		if (!tag_timing_works(&t)) break;
+		best.hold_ns = t.hold_ns;
+	}
+	for (int i = 0; i < ARRAY_LENGTH(tag_calibration_ns); i++) {
+		struct xop_tag_timing t = { .setup_ns = tag_calibration_ns[i], .hold_ns = best.hold_ns };
+		if (!tag_timing_works(&t)) break;
+		best.setup_ns = t.setup_ns;
+	}
+
+	struct xop_tag_timing result = {
+		.setup_ns = best.setup_ns * TAG_CALIBRATION_MARGIN,
+		.hold_ns  = best.hold_ns  * TAG_CALIBRATION_MARGIN,
+	};
+	if (result.setup_ns > safe.setup_ns) result.setup_ns = safe.setup_ns;
+	if (result.hold_ns  > safe.hold_ns)  result.hold_ns  = safe.hold_ns;
+	tag_timing_profile = result;
+	DONE();
+}
+void xop_calibrate_tag_timing(void)
+{
+	reset_and_kill_output();
+	run(job_calibrate_tag_timing);
+}
+
+void xop_get_tag_timing(struct xop_tag_timing* t)
+{
+	*t = tag_timing_profile;
+}
+
+void xop_set_tag_timing(const struct xop_tag_timing* t)
+{
+	tag_timing_profile = *t;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // select head //////////////////////////////////////////////////////////////
 void job_select_head(void)
@@ -457,14 +805,460 @@ void xop_select_head(unsigned head)
 
 /////////////////////////////////////////////////////////////////////////////
 // read data ////////////////////////////////////////////////////////////////
-unsigned xop_read_data(unsigned n_32bit_words, unsigned index_sync, unsigned skip_checks)
+// Streams raw READ_DATA (see raw_stream.h) with read gate enabled, marking
+// INDEX pulses in the stream. Core1 only has to watch INDEX; PIO/DMA do the
+// rest, and core0 drains the stream.
+void job_read_data(void)
+{
+	BEGIN();
+	const int skip_checks = job_args.read_data.skip_checks;
+	if (!skip_checks) check_drive_error();
+	tag3_ctrl(TAG3BIT_READ_GATE);
+	if (job_args.read_data.index_sync) wait_for_index(skip_checks);
+	raw_stream_start(job_args.read_data.n_32bit_words);
+	int prev_index = (gpio_get_all() & (1 << GPIO_INDEX)) != 0;
+	if (prev_index) raw_stream_mark_index();
+	while (raw_stream_is_capturing() && !raw_stream_has_overflowed()) {
+		const int index = (gpio_get_all() & (1 << GPIO_INDEX)) != 0;
+		if (index && !prev_index) raw_stream_mark_index();
+		prev_index = index;
+	}
+	raw_stream_stop();
+	clear_output();
+	if (raw_stream_has_overflowed()) {
+		ERROR(XST_ERR_OVERFLOW);
+	}
+	DONE();
+}
+void xop_read_data(unsigned n_32bit_words, unsigned index_sync, unsigned skip_checks)
 {
-	PANIC(PANIC_XXX); // doesn't currently make sense
+	reset_and_kill_output();
+	job_args.read_data.n_32bit_words = n_32bit_words;
+	job_args.read_data.index_sync = index_sync;
+	job_args.read_data.skip_checks = skip_checks;
+	run(job_read_data);
 }
 
 
 /////////////////////////////////////////////////////////////////////////////
 // batch read ///////////////////////////////////////////////////////////////
+
+_Static_assert(CR8044READ_MAX_SECTORS <= CLOCKED_READ_MAX_SECTORS, "sector attempts don't fit in buffer metadata");
+
+// A track capture is built from one or more revolutions; the first read goes
+// directly into the track buffer, later reads go into the retry buffer, and
+// the first good copy of each sector is kept.
+struct track_capture {
+	unsigned cylinder;
+	unsigned head;
+	unsigned buffer_index;
+	uint8_t* data;
+	unsigned n_started;
+	unsigned n_reads;
+	uint32_t address_ok_mask;
+	uint32_t data_ok_mask;
+	uint8_t attempts[CLOCKED_READ_MAX_SECTORS]; // read number that got the sector right; 0=never
+	enum cr8044read_start_mode start_mode;
+	// start mode of the (at most two) reads in flight, by read number
+	enum cr8044read_start_mode read_modes[2];
+	struct capture_telemetry telemetry;
+	unsigned gap_a_wait;
+	unsigned gap_b_wait;
+	// SYNC positions of the last read (by capture slot), if it had no
+	// SYNC retries
+	int has_sync_offsets;
+	uint16_t address_sync_offsets[CR8044READ_MAX_SECTORS];
+	uint16_t data_sync_offsets[CR8044READ_MAX_SECTORS];
+};
+
+// BATCH_FLAG_ANY_SECTOR; tracks fall back to CR8044READ_START_AT_INDEX if a
+// capture can't be put in sector order
+static enum cr8044read_start_mode batch_start_mode;
+static unsigned batch_sync_retries0;
+static int batch_auto_tune; // BATCH_FLAG_AUTO_TUNE
+
+static void set_batch_flags(unsigned flags)
+{
+	batch_start_mode = (flags & BATCH_FLAG_ANY_SECTOR) ? CR8044READ_START_AT_SECTOR : CR8044READ_START_AT_INDEX;
+	batch_auto_tune = (flags & BATCH_FLAG_AUTO_TUNE) != 0;
+}
+
+static unsigned allocate_buffer_or_wait(unsigned size)
+{
+	if (size > get_max_buffer_size()) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+	if (!can_allocate_buffer(size)) {
+		// woken by the consumer freeing space (or the deadline)
+		const absolute_time_t t0 = get_absolute_time();
+		const absolute_time_t deadline = t0 + 10000000;
+		while (!can_allocate_buffer(size)) {
+			if (time_reached(deadline)) {
+				add_producer_stall(get_absolute_time() - t0);
+				ERROR(XST_ERR_TIMEOUT);
+			}
+			pin_events_sleep_until(deadline);
+		}
+		add_producer_stall(get_absolute_time() - t0);
+	}
+	return allocate_buffer(size);
+}
+
+static unsigned allocate_track_buffer(void)
+{
+	const unsigned buffer_index = allocate_buffer_or_wait(cr8044read_get_capture_size());
+	n_unwritten_track_buffers++;
+	return buffer_index;
+}
+
+static uint8_t* get_retry_buffer(unsigned i)
+{
+	const unsigned capture_size = cr8044read_get_capture_size();
+	if (retry_buffer_index < 0) retry_buffer_index = allocate_buffer_or_wait(2*capture_size);
+	return get_buffer_data(retry_buffer_index) + i*capture_size;
+}
+
+static void track_capture_begin(struct track_capture* tc, unsigned buffer_index, unsigned head)
+{
+	memset(tc, 0, sizeof *tc);
+	tc->head = head;
+	tc->buffer_index = buffer_index;
+	tc->cylinder = current_cylinder_according_to_the_controller;
+	tc->start_mode = batch_start_mode;
+	tc->data = get_buffer_data(buffer_index);
+	// looked up here rather than in track_capture_start(), which may run
+	// in the previous track's Gap-C
+	const struct cr8044read_layout* layout = cr8044read_get_layout();
+	tc->gap_a_wait = layout->gap_a_wait;
+	tc->gap_b_wait = layout->gap_b_wait;
+	if (batch_auto_tune) sync_tune_get_waits(head, tc->cylinder, &tc->gap_a_wait, &tc->gap_b_wait);
+}
+
+static int track_capture_is_complete(struct track_capture* tc)
+{
+	return tc->n_reads > 0 && (tc->address_ok_mask & tc->data_ok_mask) == cr8044read_get_all_sectors_mask();
+}
+
+static uint8_t* track_capture_dst(struct track_capture* tc, unsigned read_number)
+{
+	return read_number == 0 ? tc->data : get_retry_buffer(read_number & 1);
+}
+
+static void track_capture_start(struct track_capture* tc)
+{
+	if ((tc->n_started - tc->n_reads) >= 2) PANIC(PANIC_UNEXPECTED_STATE);
+	tc->read_modes[tc->n_started & 1] = tc->start_mode;
+	// a read queued behind another of the same track uses the same waits
+	// the layout's waits were accepted, and tuned gap-b waits are at least
+	// SYNC_TUNE_MIN_GAP_B_WAIT, which exceeds any padding
+	if (!cr8044read_is_busy() && !cr8044read_set_gap_waits(tc->gap_a_wait, tc->gap_b_wait)) PANIC(PANIC_UNEXPECTED_STATE);
+	cr8044read_start(track_capture_dst(tc, tc->n_started), tc->start_mode);
+	tc->n_started++;
+}
+
+static void track_capture_wait(struct track_capture* tc)
+{
+	const absolute_time_t t0 = get_absolute_time();
+	cr8044read_wait();
+	batch_stats.idle_us += get_absolute_time() - t0;
+
+	struct cr8044read_telemetry t;
+	cr8044read_get_telemetry(&t);
+	struct capture_telemetry* ct = &tc->telemetry;
+	ct->n_captures++;
+	ct->fdebug |= t.fdebug;
+	ct->n_words_missing += t.n_words_missing;
+	ct->n_pull_words_left += t.n_pull_words_left;
+	ct->total_us += t.duration_us;
+	if (t.duration_us > ct->max_us) ct->max_us = t.duration_us;
+	if (t.fdebug & CAPTURE_FDEBUG_RXSTALL) batch_stats.n_rx_stalls++;
+	if (t.fdebug & CAPTURE_FDEBUG_TXSTALL) batch_stats.n_tx_stalls++;
+	if (t.n_words_missing > 0)             batch_stats.n_incomplete_captures++;
+	batch_stats.capture_us += t.duration_us;
+	if (t.duration_us > batch_stats.max_capture_us) batch_stats.max_capture_us = t.duration_us;
+	batch_stats.n_sync_give_ups += t.n_sync_give_ups;
+	tc->has_sync_offsets = cr8044read_get_sync_offsets(tc->address_sync_offsets, tc->data_sync_offsets);
+
+	tc->n_reads++;
+	batch_stats.n_revolutions++;
+	batch_stats.n_sync_retries = cr8044read_get_n_sync_retries() - batch_sync_retries0;
+}
+
+// verifies the last read and merges newly good sectors into the track
+static void track_capture_merge(struct track_capture* tc)
+{
+	const unsigned read_number = tc->n_reads - 1;
+	const int is_first = (read_number == 0);
+	uint8_t* dst = track_capture_dst(tc, read_number);
+
+	cr8044read_unpack(dst);
+
+	uint32_t address_ok_mask, data_ok_mask;
+	int first_sector = 0;
+	if (tc->read_modes[read_number & 1] == CR8044READ_START_AT_SECTOR) first_sector = cr8044read_rotate_to_index(dst);
+	if (first_sector < 0) {
+		// sector order unknown; nothing in this read can be trusted
+		address_ok_mask = 0;
+		data_ok_mask = 0;
+		tc->start_mode = CR8044READ_START_AT_INDEX;
+		batch_stats.n_unlabelled_reads++;
+	} else {
+		cr8044read_verify(dst, &address_ok_mask, &data_ok_mask);
+	}
+	const int n_sectors = cr8044read_get_layout()->n_sectors;
+	if (tc->has_sync_offsets) {
+		// only fields that passed CRC were really read from a SYNC
+		for (int slot = 0; slot < n_sectors; slot++) {
+			const int i = (first_sector + slot) % n_sectors;
+			const uint16_t a = tc->address_sync_offsets[slot];
+			const uint16_t d = tc->data_sync_offsets[slot];
+			if ((address_ok_mask & (1 << i)) && a != CR8044READ_SYNC_OFFSET_UNKNOWN) sync_tune_add(tc->head, tc->cylinder, SYNC_FIELD_ADDRESS, a);
+			if ((data_ok_mask & (1 << i))    && d != CR8044READ_SYNC_OFFSET_UNKNOWN) sync_tune_add(tc->head, tc->cylinder, SYNC_FIELD_DATA,    d);
+		}
+	}
+
+	uint32_t fixed_mask;
+	if (is_first) {
+		tc->address_ok_mask = address_ok_mask;
+		tc->data_ok_mask = data_ok_mask;
+		fixed_mask = address_ok_mask & data_ok_mask;
+	} else {
+		fixed_mask = (address_ok_mask & data_ok_mask) & ~(tc->address_ok_mask & tc->data_ok_mask);
+		tc->address_ok_mask |= fixed_mask;
+		tc->data_ok_mask |= fixed_mask;
+	}
+
+	const unsigned stride = cr8044read_get_sector_stride();
+	for (int i = 0; i < n_sectors; i++) {
+		if ((fixed_mask & (1 << i)) == 0) continue;
+		tc->attempts[i] = tc->n_reads;
+		if (!is_first) {
+			const unsigned offset = i * stride;
+			memcpy(tc->data + offset, dst + offset, stride);
+		}
+	}
+}
+
+// reads revolutions (at most `max_reads`) until all sectors pass CRC. the
+// next revolution is queued before the previous one is verified, so re-reads
+// don't have to wait for another INDEX; it's aborted if it turns out not to
+// be needed. nothing else may be capturing.
+static void track_capture_read_until_complete(struct track_capture* tc, unsigned max_reads)
+{
+	if (max_reads == 0 || track_capture_is_complete(tc)) return;
+	const unsigned n0 = tc->n_reads;
+	track_capture_start(tc);
+	for (;;) {
+		if ((tc->n_started - n0) < max_reads) track_capture_start(tc);
+		track_capture_wait(tc);
+		track_capture_merge(tc);
+		if (track_capture_is_complete(tc) || (tc->n_reads - n0) >= max_reads) break;
+	}
+	if (tc->n_started != tc->n_reads) {
+		cr8044read_abort();
+		tc->n_started = tc->n_reads;
+	}
+}
+
+static void track_capture_end(struct track_capture* tc)
+{
+	if (batch_adjustment >= 0) {
+		const struct batch_position position = {
+			.cylinder   = tc->cylinder,
+			.head       = tc->head,
+			.adjustment = batch_adjustment,
+		};
+		set_buffer_batch_position(tc->buffer_index, &position);
+	}
+	set_buffer_size(tc->buffer_index, cr8044read_get_unpacked_size());
+	set_buffer_sector_status(tc->buffer_index, cr8044read_get_layout()->n_sectors, tc->address_ok_mask, tc->data_ok_mask);
+	set_buffer_sector_attempts(tc->buffer_index, tc->attempts);
+	set_buffer_capture_telemetry(tc->buffer_index, &tc->telemetry);
+	batch_stats.n_tracks++;
+	if (!track_capture_is_complete(tc)) batch_stats.n_bad_tracks++;
+	wrote_buffer(tc->buffer_index);
+	if (--n_unwritten_track_buffers == 0 && retry_buffer_index >= 0) {
+		discard_buffer(retry_buffer_index);
+		retry_buffer_index = -1;
+	}
+}
+
+static const char* servo_offset_name(int servo_offset)
+{
+	return
+		servo_offset == ADAPTIVE ? "adaptive" :
+		servo_offset == -1       ? "negative" :
+		servo_offset ==  1       ? "positive" :
+		                           "neutral";
+}
+
+static const char* data_strobe_delay_name(int data_strobe_delay)
+{
+	return
+		data_strobe_delay == ADAPTIVE ? "adaptive" :
+		data_strobe_delay == -1       ? "early" :
+		data_strobe_delay ==  1       ? "late" :
+		                                "neutral";
+}
+
+static void set_track_filename(unsigned buffer_index, unsigned cylinder, unsigned head, int servo_offset, int data_strobe_delay)
+{
+	snprintf(
+		get_buffer_filename(buffer_index),
+		CLOCKED_READ_BUFFER_FILENAME_MAX_LENGTH,
+		"cylinder%.4d-head%d-servo_%s-strobe_%s.cr8044nrz", cylinder, head,
+		servo_offset_name(servo_offset),
+		data_strobe_delay_name(data_strobe_delay));
+}
+
+static void get_adjustment_range(int arg, int* first, int* last)
+{
+	const int is_range = (arg == ENTIRE_RANGE || arg == ADAPTIVE);
+	*first = is_range ? -1 : arg;
+	if (*first < -1) *first = -1;
+	*last = is_range ?  1 : arg;
+	if (*last > 1) *last = 1;
+}
+
+struct read_adjustment {
+	int servo_offset;
+	int data_strobe_delay;
+};
+
+#define MAX_READ_ADJUSTMENTS (9)
+
+// Adaptive mode: each track is read at the adjustment that last worked for
+// the head (on the previous cylinder) and only escalates through the other
+// adjustments, least extreme first, while sectors keep failing CRC. Good
+// sectors from all reads are merged into one track buffer. Returns the mask
+// of good sectors.
+static uint32_t read_track_adaptive(
+	unsigned cylinder,
+	unsigned head,
+	const struct read_adjustment* adjustments,
+	int n_adjustments,
+	int* preferred_adjustment,
+	unsigned max_retries)
+{
+	struct track_capture tc;
+	const unsigned buffer_index = allocate_track_buffer();
+	set_track_filename(buffer_index, cylinder, head, ADAPTIVE, ADAPTIVE);
+	track_capture_begin(&tc, buffer_index, head);
+	const int p = *preferred_adjustment;
+	for (int k = 0; k < n_adjustments && !track_capture_is_complete(&tc); k++) {
+		// try preferred adjustment first, then the rest in order
+		const int ai = k == 0 ? p : (k-1) < p ? (k-1) : k;
+		const struct read_adjustment* adj = &adjustments[ai];
+		set_bits(get_read_adjustment_bits(adj->servo_offset, adj->data_strobe_delay));
+		track_capture_read_until_complete(&tc, max_retries + 1);
+		if (track_capture_is_complete(&tc)) *preferred_adjustment = ai;
+	}
+	track_capture_end(&tc);
+	return tc.address_ok_mask & tc.data_ok_mask;
+}
+
+// reads a track at one read adjustment; the head must be selected and TAG3
+// held. Returns the mask of good sectors.
+static uint32_t read_track(unsigned cylinder, unsigned head, int servo_offset, int data_strobe_delay, unsigned max_retries)
+{
+	set_bits(get_read_adjustment_bits(servo_offset, data_strobe_delay));
+
+	const unsigned buffer_index = allocate_track_buffer();
+	set_track_filename(buffer_index, cylinder, head, servo_offset, data_strobe_delay);
+
+	struct track_capture tc;
+	track_capture_begin(&tc, buffer_index, head);
+	track_capture_read_until_complete(&tc, max_retries + 1);
+	track_capture_end(&tc);
+	return tc.address_ok_mask & tc.data_ok_mask;
+}
+
+// all adjustments in the given ranges, sorted by "distance" from neutral so
+// that the least extreme adjustments are tried first
+static int get_adaptive_adjustments(struct read_adjustment* adjustments, int servo_offset0, int servo_offset1, int data_strobe_delay0, int data_strobe_delay1)
+{
+	int n_adjustments = 0;
+	for (int distance = 0; distance <= 2; distance++) {
+		for (int servo_offset = servo_offset0; servo_offset <= servo_offset1; servo_offset++) {
+			for (int data_strobe_delay = data_strobe_delay0; data_strobe_delay <= data_strobe_delay1; data_strobe_delay++) {
+				if ((abs(servo_offset) + abs(data_strobe_delay)) != distance) continue;
+				if (n_adjustments >= MAX_READ_ADJUSTMENTS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+				adjustments[n_adjustments].servo_offset = servo_offset;
+				adjustments[n_adjustments].data_strobe_delay = data_strobe_delay;
+				n_adjustments++;
+			}
+		}
+	}
+	return n_adjustments;
+}
+
+// re-reads a track (at most `max_retries` revolutions) until all its sectors
+// pass CRC
+static void track_capture_retry(struct track_capture* tc, unsigned ctrl, unsigned max_retries)
+{
+	if (track_capture_is_complete(tc) || max_retries == 0) return;
+	switch_head_and_enable_read(tc->head, ctrl);
+	track_capture_read_until_complete(tc, max_retries);
+}
+
+// Pipelined mode: as soon as a capture completes (in the last sector's Gap-C)
+// the next head is selected and its capture armed, so consecutive heads on a
+// cylinder are read on back-to-back revolutions. The previous track is
+// verified while the next one is being captured. Re-reads break the pipeline;
+// they're done after the in-flight capture has completed, which is why two
+// track buffers may be allocated at a time.
+static void read_cylinder_pipelined(
+	unsigned cylinder,
+	unsigned head_set,
+	int servo_offset,
+	int data_strobe_delay,
+	unsigned max_retries)
+{
+	const unsigned ctrl = get_read_adjustment_bits(servo_offset, data_strobe_delay);
+
+	unsigned heads[DRIVE_HEAD_COUNT];
+	int n_heads = 0;
+	for (unsigned head = 0; head < DRIVE_HEAD_COUNT; head++) {
+		if (head_set & (1 << head)) heads[n_heads++] = head;
+	}
+
+	struct track_capture tcs[2];
+	struct track_capture* prev = NULL; // captured or being captured
+	for (int i = 0; i <= n_heads; i++) {
+		struct track_capture* tc = NULL;
+		if (i < n_heads) {
+			tc = &tcs[i & 1];
+			const unsigned buffer_index = allocate_track_buffer();
+			set_track_filename(buffer_index, cylinder, heads[i], servo_offset, data_strobe_delay);
+			track_capture_begin(tc, buffer_index, heads[i]);
+		}
+
+		if (prev != NULL) track_capture_wait(prev);
+		if (tc != NULL) {
+			switch_head_and_enable_read(tc->head, ctrl);
+			track_capture_start(tc);
+		}
+		if (prev == NULL) {
+			prev = tc;
+			continue;
+		}
+
+		track_capture_merge(prev);
+		if (tc != NULL && !track_capture_is_complete(prev) && max_retries > 0) {
+			track_capture_wait(tc);
+			track_capture_merge(tc);
+			track_capture_retry(prev, ctrl, max_retries);
+			track_capture_end(prev);
+			track_capture_retry(tc, ctrl, max_retries);
+			track_capture_end(tc);
+			prev = NULL;
+			continue;
+		}
+		track_capture_retry(prev, ctrl, max_retries);
+		track_capture_end(prev);
+		prev = tc;
+	}
+	clear_output();
+}
+
 void job_batch_read(void)
 {
 	BEGIN();
@@ -475,21 +1269,43 @@ void job_batch_read(void)
 	//const unsigned n_32bit_words_per_track = job_args.batch_read.n_32bit_words_per_track;
 	const int arg_servo_offset = job_args.batch_read.servo_offset;
 	const int arg_data_strobe_delay = job_args.batch_read.data_strobe_delay;
-
-	int servo_offset0 = arg_servo_offset == ENTIRE_RANGE ? -1 : arg_servo_offset;
-	if (servo_offset0 < -1) servo_offset0 = -1;
-
-	int servo_offset1 = arg_servo_offset == ENTIRE_RANGE ?  1 : arg_servo_offset;
-	if (servo_offset1 >  1) servo_offset1 = 1;
-
-	int data_strobe_delay0 = arg_data_strobe_delay == ENTIRE_RANGE ? -1 : arg_data_strobe_delay;
-	if (data_strobe_delay0 < -1) data_strobe_delay0 = -1;
-
-	int data_strobe_delay1 = arg_data_strobe_delay == ENTIRE_RANGE ?  1 : arg_data_strobe_delay;
-	if (data_strobe_delay1 > 1) data_strobe_delay1 = 1;
+	const unsigned max_retries = job_args.batch_read.max_retries;
+	const unsigned flags = job_args.batch_read.flags;
+	set_batch_flags(flags);
+	batch_sync_retries0 = cr8044read_get_n_sync_retries();
+	batch_adjustment = 0;
+
+	int servo_offset0, servo_offset1;
+	get_adjustment_range(arg_servo_offset, &servo_offset0, &servo_offset1);
+	int data_strobe_delay0, data_strobe_delay1;
+	get_adjustment_range(arg_data_strobe_delay, &data_strobe_delay0, &data_strobe_delay1);
+
+	const int is_adaptive = (arg_servo_offset == ADAPTIVE || arg_data_strobe_delay == ADAPTIVE);
+	// pipelining only makes sense with one adjustment per track
+	const int is_pipelined =
+		(flags & BATCH_FLAG_PIPELINED)
+		&& !is_adaptive
+		&& servo_offset0 == servo_offset1
+		&& data_strobe_delay0 == data_strobe_delay1;
+	struct read_adjustment adjustments[MAX_READ_ADJUSTMENTS];
+	int n_adjustments = 0;
+	int preferred_adjustment[DRIVE_HEAD_COUNT] = {0};
+	if (is_adaptive) {
+		n_adjustments = get_adaptive_adjustments(adjustments, servo_offset0, servo_offset1, data_strobe_delay0, data_strobe_delay1);
+	}
 
 	for (unsigned cylinder = cylinder0; cylinder <= cylinder1; cylinder++) {
-		select_cylinder(cylinder);
+		// when resuming, the tracks up to and including the checkpoint
+		// (all on cylinder0) have already been read
+		int done_head = -1, done_adjustment = -1;
+		if (cylinder == cylinder0) {
+			done_head = job_args.batch_read.resume_head;
+			done_adjustment = job_args.batch_read.resume_adjustment;
+		}
+		#define IS_DONE(HEAD, ADJUSTMENT) \
+			((int)(HEAD) < done_head || ((int)(HEAD) == done_head && (ADJUSTMENT) <= done_adjustment))
+
+		seek(cylinder, SEEK_MODE_HYBRID);
 		// The CDC docs lists "read while off cylinder" as one of the
 		// conditions that can trigger a FAULT. Although the following
 		// section suggests the fault is only generated if requested
@@ -498,54 +1314,386 @@ void job_batch_read(void)
 		//   "This fault is generated if the drive is in an Off
 		//   Cylinder condition and it receives a Read or Write gate
 		//   from the controller."
+		const absolute_time_t t0 = get_absolute_time();
+		if (is_pipelined) {
+			unsigned heads_left = 0;
+			for (unsigned head = 0; head < DRIVE_HEAD_COUNT; head++) {
+				if (!IS_DONE(head, 0)) heads_left |= (1 << head);
+			}
+			read_cylinder_pipelined(cylinder, head_set & heads_left, servo_offset0, data_strobe_delay0, max_retries);
+			batch_stats.read_us += get_absolute_time() - t0;
+			continue;
+		}
 		unsigned mask = 1;
 		for (unsigned head = 0; head < DRIVE_HEAD_COUNT; head++, mask <<= 1) {
 			if ((head_set & mask) == 0) continue;
+			const int n_head_adjustments = is_adaptive ? 1 : (servo_offset1-servo_offset0+1)*(data_strobe_delay1-data_strobe_delay0+1);
+			if (IS_DONE(head, n_head_adjustments-1)) continue;
 			select_head(head);
 			set_bits(0);
 			gpio_put(GPIO_TAG3, 1);
+			if (is_adaptive) {
+				batch_adjustment = 0;
+				read_track_adaptive(cylinder, head, adjustments, n_adjustments, &preferred_adjustment[head], max_retries);
+				clear_output();
+				continue;
+			}
+			int adjustment = 0;
 			for (int servo_offset = servo_offset0; servo_offset <= servo_offset1; servo_offset++) {
-				for (int data_strobe_delay = data_strobe_delay0; data_strobe_delay <= data_strobe_delay1; data_strobe_delay++) {
-					set_bits(get_read_adjustment_bits(servo_offset, data_strobe_delay));
-
-					const absolute_time_t t0 = get_absolute_time();
-					while (!can_allocate_buffer()) {
-						if ((get_absolute_time() - t0) > 10000000) {
-							ERROR(XST_ERR_TIMEOUT);
-						}
-						sleep_us(5);
-					}
-					const unsigned buffer_index = allocate_buffer(MAX_DATA_BUFFER_SIZE);
-					snprintf(
-						get_buffer_filename(buffer_index),
-						CLOCKED_READ_BUFFER_FILENAME_MAX_LENGTH,
-						"cylinder%.4d-head%d-servo_%s-strobe_%s.cr8044nrz", cylinder, head,
-
-						servo_offset == -1 ? "negative" :
-						servo_offset ==  1 ? "positive" :
-								     "neutral"
-						,
-						data_strobe_delay == -1 ? "early" :
-						data_strobe_delay ==  1 ? "late" :
-									  "neutral");
-
-					cr8044read_execute(get_buffer_data(buffer_index));
-					wrote_buffer(buffer_index);
+				for (int data_strobe_delay = data_strobe_delay0; data_strobe_delay <= data_strobe_delay1; data_strobe_delay++, adjustment++) {
+					if (IS_DONE(head, adjustment)) continue;
+					batch_adjustment = adjustment;
+					read_track(cylinder, head, servo_offset, data_strobe_delay, max_retries);
 				}
 			}
 			clear_output();
 		}
+		batch_stats.read_us += get_absolute_time() - t0;
+		#undef IS_DONE
 	}
 	DONE();
 }
-void xop_read_batch(unsigned cylinder0, unsigned cylinder1, unsigned head_set, unsigned n_32bit_words_per_track, int servo_offset, int data_strobe_delay)
+void xop_get_batch_stats(struct xop_batch_stats* stats)
+{
+	*stats = batch_stats;
+}
+
+static void set_batch_read_args(unsigned cylinder0, unsigned cylinder1, unsigned head_set, unsigned n_32bit_words_per_track, int servo_offset, int data_strobe_delay, unsigned max_retries, unsigned flags)
 {
-	reset_and_kill_output();
 	job_args.batch_read.n_32bit_words_per_track = n_32bit_words_per_track;
 	job_args.batch_read.cylinder0 = cylinder0;
 	job_args.batch_read.cylinder1 = cylinder1;
 	job_args.batch_read.head_set = head_set;
 	job_args.batch_read.servo_offset = servo_offset;
 	job_args.batch_read.data_strobe_delay = data_strobe_delay;
+	job_args.batch_read.max_retries = max_retries;
+	job_args.batch_read.flags = flags;
+}
+
+void xop_read_batch(unsigned cylinder0, unsigned cylinder1, unsigned head_set, unsigned n_32bit_words_per_track, int servo_offset, int data_strobe_delay, unsigned max_retries, unsigned flags)
+{
+	reset_and_kill_output();
+	set_batch_read_args(cylinder0, cylinder1, head_set, n_32bit_words_per_track, servo_offset, data_strobe_delay, max_retries, flags);
+	job_args.batch_read.resume_head = -1;
+	job_args.batch_read.resume_adjustment = -1;
+	run(job_batch_read);
+}
+
+void xop_resume_batch(unsigned checkpoint_cylinder, unsigned cylinder1, unsigned head_set, unsigned n_32bit_words_per_track, int servo_offset, int data_strobe_delay, unsigned max_retries, unsigned flags, unsigned checkpoint_head, unsigned checkpoint_adjustment)
+{
+	reset_and_kill_output();
+	set_batch_read_args(checkpoint_cylinder, cylinder1, head_set, n_32bit_words_per_track, servo_offset, data_strobe_delay, max_retries, flags);
+	job_args.batch_read.resume_head = checkpoint_head;
+	job_args.batch_read.resume_adjustment = checkpoint_adjustment;
 	run(job_batch_read);
 }
+
+/////////////////////////////////////////////////////////////////////////////
+// job script ///////////////////////////////////////////////////////////////
+
+struct script_step {
+	uint8_t op;
+	uint8_t a;
+	uint16_t b;
+};
+
+static struct script_step script[SCRIPT_MAX_STEPS];
+static unsigned script_n_steps;
+static volatile unsigned script_current_step;
+
+// step results are passed to core0 through a small ring; the job waits for
+// core0 if it falls a whole ring behind
+#define SCRIPT_RESULT_RING_SIZE (64)
+static struct xop_script_step_result script_results[SCRIPT_RESULT_RING_SIZE];
+static volatile unsigned script_result_write;
+static volatile unsigned script_result_read;
+
+void xop_script_clear(void)
+{
+	script_n_steps = 0;
+}
+
+static int is_valid_script_adjustment(int adjustment)
+{
+	return (MINUS <= adjustment && adjustment <= PLUS) || adjustment == ADAPTIVE;
+}
+
+static void get_queued_track_adjustment(const struct script_step* step, int* servo_offset, int* data_strobe_delay)
+{
+	if (step->a & (1 << 7)) {
+		*servo_offset = *data_strobe_delay = ADAPTIVE;
+	} else {
+		*servo_offset      = (int)((step->a >> 3) & 3) - 1;
+		*data_strobe_delay = (int)((step->a >> 5) & 3) - 1;
+	}
+}
+
+static int is_valid_queued_track(const struct script_step* step)
+{
+	int servo_offset, data_strobe_delay;
+	get_queued_track_adjustment(step, &servo_offset, &data_strobe_delay);
+	return
+		(step->a & 7) < DRIVE_HEAD_COUNT
+		&& step->b < DRIVE_CYLINDER_COUNT
+		&& is_valid_script_adjustment(servo_offset)
+		&& is_valid_script_adjustment(data_strobe_delay);
+}
+
+static int is_valid_script_step(const struct script_step* step)
+{
+	switch (step->op) {
+	case SCRIPT_OP_SEEK:           return step->b < DRIVE_CYLINDER_COUNT;
+	case SCRIPT_OP_SELECT_HEAD:    return step->a < DRIVE_HEAD_COUNT;
+	case SCRIPT_OP_SET_ADJUSTMENT: return is_valid_script_adjustment((int8_t)step->a) && is_valid_script_adjustment((int16_t)step->b);
+	case SCRIPT_OP_SET_RETRIES:    return step->b <= 255; // attempts are counted in bytes
+	case SCRIPT_OP_SET_FLAGS:      return 1;
+	case SCRIPT_OP_READ_TRACK:     return step->a < DRIVE_HEAD_COUNT;
+	case SCRIPT_OP_WAIT_MS:        return 1;
+	case SCRIPT_OP_WAIT_INDEX:     return 1;
+	case SCRIPT_OP_RETURN_TO_ZERO: return 1;
+	case SCRIPT_OP_SET_SEEK_MODE:  return step->b == SEEK_MODE_NORMAL || step->b == SEEK_MODE_SINGLE_STEP || step->b == SEEK_MODE_HYBRID;
+	case SCRIPT_OP_QUEUE_TRACK:    return is_valid_queued_track(step);
+	case SCRIPT_OP_SERVE_QUEUE:    return 1;
+	}
+	return 0;
+}
+
+int xop_script_append(const uint8_t* steps, unsigned n_bytes)
+{
+	if ((n_bytes % SCRIPT_STEP_SIZE) != 0) return 0;
+	const unsigned n = n_bytes / SCRIPT_STEP_SIZE;
+	if ((script_n_steps + n) > SCRIPT_MAX_STEPS) return 0;
+	struct script_step* wp = &script[script_n_steps];
+	for (unsigned i = 0; i < n; i++, steps += SCRIPT_STEP_SIZE) {
+		wp[i].op = steps[0];
+		wp[i].a  = steps[1];
+		wp[i].b  = steps[2] | (steps[3] << 8);
+		if (!is_valid_script_step(&wp[i])) return 0;
+	}
+	script_n_steps += n;
+	return 1;
+}
+
+unsigned xop_script_get_n_steps(void)
+{
+	return script_n_steps;
+}
+
+unsigned xop_script_get_current_step(void)
+{
+	return script_current_step;
+}
+
+int xop_pop_script_step_result(struct xop_script_step_result* result)
+{
+	const unsigned r = script_result_read;
+	if (r == script_result_write) return 0;
+	__dmb();
+	*result = script_results[r % SCRIPT_RESULT_RING_SIZE];
+	__dmb();
+	script_result_read = r+1;
+	return 1;
+}
+
+static void push_script_step_result(unsigned step, unsigned op, unsigned result, uint32_t duration_us)
+{
+	const unsigned w = script_result_write;
+	while ((w - script_result_read) >= SCRIPT_RESULT_RING_SIZE) tight_loop_contents();
+	struct xop_script_step_result* sr = &script_results[w % SCRIPT_RESULT_RING_SIZE];
+	sr->step = step;
+	sr->op = op;
+	sr->result = result;
+	sr->duration_us = duration_us;
+	__dmb();
+	script_result_write = w+1;
+}
+
+struct script_state {
+	int servo_offset;
+	int data_strobe_delay;
+	unsigned max_retries;
+	enum seek_mode seek_mode;
+	int preferred_adjustment[DRIVE_HEAD_COUNT];
+};
+
+// READ_TRACK at the current cylinder; returns number of good sectors
+static unsigned script_read_track(struct script_state* st, unsigned head, int servo_offset, int data_strobe_delay)
+{
+	const absolute_time_t t0 = get_absolute_time();
+	const unsigned cylinder = current_cylinder_according_to_the_controller;
+	uint32_t ok_mask;
+	select_head(head);
+	set_bits(0);
+	gpio_put(GPIO_TAG3, 1);
+	if (servo_offset == ADAPTIVE || data_strobe_delay == ADAPTIVE) {
+		int servo_offset0, servo_offset1, data_strobe_delay0, data_strobe_delay1;
+		get_adjustment_range(servo_offset, &servo_offset0, &servo_offset1);
+		get_adjustment_range(data_strobe_delay, &data_strobe_delay0, &data_strobe_delay1);
+		struct read_adjustment adjustments[MAX_READ_ADJUSTMENTS];
+		const int n_adjustments = get_adaptive_adjustments(adjustments, servo_offset0, servo_offset1, data_strobe_delay0, data_strobe_delay1);
+		int* p = &st->preferred_adjustment[head];
+		if (*p >= n_adjustments) *p = 0;
+		ok_mask = read_track_adaptive(cylinder, head, adjustments, n_adjustments, p, st->max_retries);
+	} else {
+		ok_mask = read_track(cylinder, head, servo_offset, data_strobe_delay, st->max_retries);
+	}
+	clear_output();
+	batch_stats.read_us += get_absolute_time() - t0;
+	return __builtin_popcount(ok_mask);
+}
+
+// QUEUE_TRACK steps (indices into script) waiting for SERVE_QUEUE
+static uint16_t track_queue[SCRIPT_MAX_STEPS];
+static unsigned track_queue_length;
+
+static int compare_queued_tracks(const void* pa, const void* pb)
+{
+	const struct script_step* a = &script[*(const uint16_t*)pa];
+	const struct script_step* b = &script[*(const uint16_t*)pb];
+	if (a->b != b->b) return (int)a->b - (int)b->b;
+	return (int)*(const uint16_t*)pa - (int)*(const uint16_t*)pb; // request order within a cylinder
+}
+
+static void serve_queued_track(struct script_state* st, unsigned step_index, int* cylinder)
+{
+	const struct script_step* step = &script[step_index];
+	const absolute_time_t t0 = get_absolute_time();
+	if ((int)step->b != *cylinder) {
+		*cylinder = step->b;
+		const uint32_t estimate = estimate_seek_us(current_cylinder_according_to_the_controller, *cylinder, st->seek_mode);
+		seek(*cylinder, st->seek_mode);
+		batch_stats.queue_estimated_seek_us += estimate;
+	}
+	int servo_offset, data_strobe_delay;
+	get_queued_track_adjustment(step, &servo_offset, &data_strobe_delay);
+	const unsigned result = script_read_track(st, step->a & 7, servo_offset, data_strobe_delay);
+	push_script_step_result(step_index, step->op, result, get_absolute_time() - t0);
+}
+
+// serves sorted track_queue[i0:i1] upwards or downwards; downwards reverses
+// the cylinder order only, so requests for one cylinder are always served in
+// request order
+static void serve_track_queue_sweep(struct script_state* st, unsigned i0, unsigned i1, int is_down, int* cylinder)
+{
+	if (!is_down) {
+		for (unsigned i = i0; i < i1; i++) serve_queued_track(st, track_queue[i], cylinder);
+		return;
+	}
+	unsigned end = i1;
+	while (end > i0) {
+		unsigned begin = end - 1;
+		while (begin > i0 && script[track_queue[begin-1]].b == script[track_queue[end-1]].b) begin--;
+		for (unsigned i = begin; i < end; i++) serve_queued_track(st, track_queue[i], cylinder);
+		end = begin;
+	}
+}
+
+// SCAN ("elevator") order: sweep from the current cylinder towards whichever
+// end of the requested range is nearer, then sweep back to the other end.
+// every requested cylinder is visited once, and the heads travel at most
+// the requested range plus the shorter distance to one of its ends.
+static void serve_track_queue(struct script_state* st)
+{
+	const unsigned n = track_queue_length;
+	if (n == 0) return;
+
+	const unsigned c0 = current_cylinder_according_to_the_controller;
+	{
+		unsigned c = c0;
+		for (unsigned i = 0; i < n; i++) {
+			const unsigned ci = script[track_queue[i]].b;
+			batch_stats.queue_unscheduled_seek_us += estimate_seek_us(c, ci, st->seek_mode);
+			c = ci;
+		}
+	}
+
+	qsort(track_queue, n, sizeof track_queue[0], compare_queued_tracks);
+	const unsigned lo = script[track_queue[0]].b;
+	const unsigned hi = script[track_queue[n-1]].b;
+	unsigned k = 0; // first request at or above c0
+	while (k < n && script[track_queue[k]].b < c0) k++;
+	const int is_up_first = (k == 0) || (k < n && (hi - c0) <= (c0 - lo));
+
+	int cylinder = -1;
+	if (is_up_first) {
+		serve_track_queue_sweep(st, k, n, 0, &cylinder);
+		serve_track_queue_sweep(st, 0, k, 1, &cylinder);
+	} else {
+		serve_track_queue_sweep(st, 0, k, 1, &cylinder);
+		serve_track_queue_sweep(st, k, n, 0, &cylinder);
+	}
+	track_queue_length = 0;
+}
+
+void job_run_script(void)
+{
+	BEGIN();
+	check_drive_error();
+	set_batch_flags(0);
+	batch_sync_retries0 = cr8044read_get_n_sync_retries();
+	struct script_state st = {
+		.servo_offset      = NEUTRAL,
+		.data_strobe_delay = NEUTRAL,
+		.seek_mode         = SEEK_MODE_HYBRID,
+	};
+	track_queue_length = 0;
+
+	for (unsigned i = 0; i < script_n_steps; i++) {
+		script_current_step = i;
+		const struct script_step* step = &script[i];
+		const absolute_time_t t0 = get_absolute_time();
+		unsigned result = 0;
+		switch (step->op) {
+		case SCRIPT_OP_SEEK:
+			seek(step->b, st.seek_mode);
+			break;
+		case SCRIPT_OP_SELECT_HEAD:
+			select_head(step->a);
+			break;
+		case SCRIPT_OP_SET_ADJUSTMENT:
+			st.servo_offset = (int8_t)step->a;
+			st.data_strobe_delay = (int16_t)step->b;
+			break;
+		case SCRIPT_OP_SET_RETRIES:
+			st.max_retries = step->b;
+			break;
+		case SCRIPT_OP_SET_FLAGS:
+			set_batch_flags(step->b);
+			break;
+		case SCRIPT_OP_READ_TRACK:
+			result = script_read_track(&st, step->a, st.servo_offset, st.data_strobe_delay);
+			break;
+		case SCRIPT_OP_WAIT_MS:
+			sleep_ms(step->b);
+			break;
+		case SCRIPT_OP_WAIT_INDEX:
+			for (unsigned k = 0; k < step->b; k++) wait_for_index(0);
+			break;
+		case SCRIPT_OP_RETURN_TO_ZERO:
+			return_to_normal();
+			break;
+		case SCRIPT_OP_SET_SEEK_MODE:
+			st.seek_mode = step->b;
+			break;
+		case SCRIPT_OP_QUEUE_TRACK:
+			if (track_queue_length >= SCRIPT_MAX_STEPS) PANIC(PANIC_BOUNDS_CHECK_FAILED);
+			track_queue[track_queue_length++] = i;
+			continue; // reported when served
+		case SCRIPT_OP_SERVE_QUEUE:
+			serve_track_queue(&st);
+			break;
+		default: PANIC(PANIC_UNREACHABLE); // see is_valid_script_step()
+		}
+		push_script_step_result(i, step->op, result, get_absolute_time() - t0);
+	}
+	script_current_step = script_n_steps;
+	DONE();
+}
+void xop_run_script(void)
+{
+	reset_and_kill_output();
+	script_current_step = 0;
+	script_result_write = 0;
+	script_result_read = 0;
+	run(job_run_script);
+}
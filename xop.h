@@ -3,19 +3,50 @@
 #include "pico/stdlib.h"
 #include "controller_protocol.h"
 
-enum xop_status {
-	XST_RUNNING               = 0,
-	XST_DONE                  = 1,
-	XST_ERR0                  = 1000,
-	XST_ERR_DRIVE_ERROR       = 1001,
-	XST_ERR_DRIVE_NOT_READY   = 1002,
-	XST_ERR_TIMEOUT           = 1999,
-	XST_ERR_TEST              = 2001,
+struct xop_batch_stats {
+	unsigned n_tracks;
+	unsigned n_revolutions;
+	unsigned n_bad_tracks; // tracks with sectors that never passed CRC
+	uint64_t read_us;      // time spent reading tracks (excluding seeks)
+	unsigned n_unlabelled_reads; // BATCH_FLAG_ANY_SECTOR reads that couldn't be rotated into sector order
+	unsigned n_sync_retries;     // see cr8044read_get_n_sync_retries()
+	unsigned n_sync_give_ups;    // fields whose SYNC hunt ran into the next SECTOR pulse
+	uint64_t idle_us;            // time core1 spent sleeping in cr8044read_wait() and status pin waits
+	// capture path telemetry (see struct cr8044read_telemetry)
+	unsigned n_rx_stalls;           // captures that lost bits to a full RX FIFO
+	unsigned n_tx_stalls;           // captures where pull words ran dry
+	unsigned n_incomplete_captures; // stalled captures (timed out)
+	uint64_t capture_us;
+	uint32_t max_capture_us;
+	// seeks (see enum seek_mode); estimates use the drive's specified seek
+	// times (drive.h)
+	unsigned n_seeks;
+	unsigned seek_cylinders;       // total head travel
+	uint64_t seek_us;
+	uint64_t estimated_seek_us;
+	// SEEK_MODE_HYBRID: failed direct seeks (each followed by RTZ), and
+	// seeks done in single steps
+	unsigned n_seek_fallbacks;
+	unsigned n_stepped_seeks;
+	// SERVE_QUEUE seeks, estimated for elevator order (what was done) and
+	// for request order
+	uint64_t queue_estimated_seek_us;
+	uint64_t queue_unscheduled_seek_us;
+};
+
+// timing of all TAG1/TAG2/TAG3 strobes: BIT0-9 set up before the tag goes
+// high, and the tag held high; used by jobs started after it's changed
+struct xop_tag_timing {
+	uint32_t setup_ns;
+	uint32_t hold_ns;
 };
 
 enum xop_status poll_xop_status(void);
 absolute_time_t xop_duration_us(void);
 void terminate_op(void);
+void xop_get_batch_stats(struct xop_batch_stats*);
+void xop_get_tag_timing(struct xop_tag_timing*);
+void xop_set_tag_timing(const struct xop_tag_timing*);
 
 void xop_reset(void);
 void xop_blink_test(int fail);
@@ -24,8 +55,30 @@ void xop_select_unit0(void);
 void xop_select_cylinder(unsigned cylinder);
 void xop_broken_seek(unsigned cylinder);
 void xop_select_head(unsigned head);
-unsigned xop_read_data(unsigned n_32bit_words, unsigned index_sync, unsigned raw);
-void xop_read_batch(unsigned cylinder0, unsigned cylinder1, unsigned head_set, unsigned n_32bit_words_per_track, int servo_offset, int data_strobe_delay);
+void xop_read_data(unsigned n_32bit_words, unsigned index_sync, unsigned skip_checks);
+void xop_calibrate_tag_timing(void);
+// op_read_batch from just after a checkpoint (see CPPP_BATCH_CHECKPOINT);
+// the other arguments must be those of the interrupted batch
+void xop_resume_batch(unsigned checkpoint_cylinder, unsigned cylinder1, unsigned head_set, unsigned n_32bit_words_per_track, int servo_offset, int data_strobe_delay, unsigned max_retries, unsigned flags, unsigned checkpoint_head, unsigned checkpoint_adjustment);
+void xop_read_batch(unsigned cylinder0, unsigned cylinder1, unsigned head_set, unsigned n_32bit_words_per_track, int servo_offset, int data_strobe_delay, unsigned max_retries, unsigned flags);
+
+// job scripts (see EMIT_SCRIPT_OPS); the script is built on core0 while no
+// job is running and then run as one job. steps report back through
+// xop_pop_script_step_result() as they complete
+struct xop_script_step_result {
+	uint16_t step;
+	uint8_t op;
+	uint8_t result;       // READ_TRACK: number of sectors OK
+	uint32_t duration_us;
+};
+void xop_script_clear(void);
+// returns 0 (and appends nothing) if a step is invalid or the script is full
+int xop_script_append(const uint8_t* steps, unsigned n_bytes);
+unsigned xop_script_get_n_steps(void);
+// step the job is at (== number of steps completed)
+unsigned xop_script_get_current_step(void);
+int xop_pop_script_step_result(struct xop_script_step_result*);
+void xop_run_script(void);
 
 #define XOP_H
 #endif